@@ -23,21 +23,32 @@
 //       |---> PrintWorldGeneration
 //       |---> CountAllWalls
 //       |---> PlaceWalls
-//       |---> glutMainLoop
+//       |---> BuildMazeRegions
+//       |---> flowInit
+//       |---> glutMainLoop (or runBenchmark when -bench is used)
 //
 // root: + update
-//       |---> glutGet (current time)
+//       |---> getElapsedTime (current time)
 //       |---> ChangeWalls
 //       |---> PlaceWalls
 //       |---> collisionRespose
 //
+// root: + ChangeWalls
+//       |---> PickPillarWalls
+//       |---> WouldDisconnect
+//       |---> OpenMazeWall
+//       |---> CloseMazeWall
+//       |---> setFlowTarget
+//
 // root: + collisionResponse
 //       |---> DeltaGravity
 //       |---> IsWalkablePiece
+//       |---> SweepPlayer
+//       |---> FloorLevel
 //       |---> getViewPosition
 //       |---> getOldViewPosition
 //       |---> setViewPosition
-//       |---> glutGet (current time)
+//       |---> getElapsedTime (current time)
 
 
 
@@ -93,6 +104,7 @@ int MAP_SIZE_Z;
 ///
 #define GRAVITY_RATE 9.8f
 #define PLAYER_HEIGHT 2
+#define PLAYER_RADIUS 0.2f
 
 
 
@@ -116,29 +128,89 @@ int lastUpdateTime;
 
 
 ///
-/// Pillars -----------------------------------------------
-///         A 2D array of all the pillars, each pillar having references to the
-///           walls that touch it.
+/// Walls -------------------------------------------------
+///         Every wall in one array, with no pointers between the walls and
+///           the pillars. The walls along the z-axis come first, the north
+///           and south walls of each column of pillars from z = 0 up. The
+///           walls along the x-axis follow, the west and east walls of each
+///           row of pillars from x = 0 up. A pillar is only its x,z,
+///           PillarWall() works out which walls touch it.
 ///
-Pillar pillars[WALL_COUNT_X - 1][WALL_COUNT_Z - 1];
+#define Z_WALL_COUNT ((WALL_COUNT_X - 1) * WALL_COUNT_Z)
+#define MAZE_WALL_COUNT (Z_WALL_COUNT + (WALL_COUNT_X * (WALL_COUNT_Z - 1)))
+
+Wall mazeWall[MAZE_WALL_COUNT];
 
 int movingPillar_x, movingPillar_z;
-int closingWall, openingWall;
+int closingWall = -1, openingWall = -1;
 float wallPercent;
 
 
 
+///
+/// Maze snapshot -----------------------------------------
+///         The state of the walls saved in a world file with -save, the
+///           walls are listed in the order they are placed by PlaceWalls.
+///
+
+typedef struct _MazeSnapshot{
+    int wallCount;
+    int wallState[MAZE_WALL_COUNT];
+
+    int movingPillar_x, movingPillar_z;
+    int closingWall, openingWall;
+    float wallPercent;
+    int lastWallChangeTime;
+} MazeSnapshot;
+
+
+
+///
+/// Maze regions ------------------------------------------
+///         The rooms are the WALL_COUNT_X by WALL_COUNT_Z spaces between the
+///           walls, each wall is between two rooms. Every room is labelled
+///           with the region of rooms it is joined to by open walls, and the
+///           open walls which join each region without any loops are marked
+///           as its tree walls, the rest of the open walls are spare walls.
+///           Closing a spare wall can never split a region. Closing a tree
+///           wall splits it unless a spare wall joins the two sides of the
+///           tree, which is checked against the numbers the rooms are given
+///           in each tree without searching the maze.
+///
+#define MAZE_ROOM_COUNT (WALL_COUNT_X * WALL_COUNT_Z)
+
+int wallRoom[MAZE_WALL_COUNT][2];
+int treeWall[MAZE_WALL_COUNT];
+
+int spareWall[MAZE_WALL_COUNT];
+int spareSlot[MAZE_WALL_COUNT];
+int spareWallCount;
+
+int roomRegion[MAZE_ROOM_COUNT];
+int roomWall[MAZE_ROOM_COUNT][4];
+int roomWallCount[MAZE_ROOM_COUNT];
+int roomParentWall[MAZE_ROOM_COUNT];
+int roomFirst[MAZE_ROOM_COUNT];
+int roomLast[MAZE_ROOM_COUNT];
+int nextRoomNumber;
+
+int regionCount;
+int nextRegion;
+int vetoedMoves;
+
+
+
 
 
 
 ///
 /// Wall and floor manipulation forward declarations ------
 ///
-void SetupWall(Wall **targetWall, Wall **adjacentWall, GenerationInfo *genInfo, int x, int z);
+void SetupWall(Wall *wall, GenerationInfo *genInfo, int x, int z);
 void AnimateWalls();
 void ChangeWalls();
+int PickPillarWalls(int pillar_x, int pillar_z, int *pickedOpening, int *pickedClosing);
 void SetupWalls();
-void FreeWalls();
 
 void PlaceHorizontalWall(Wall *wall, int wallX, int wallZ, int deltaTime);
 void PlaceVerticalWall(Wall *wall, int wallX, int wallZ, int deltaTime);
@@ -147,6 +219,29 @@ void PlaceWalls(int deltaTime);
 void BuildWorldShell();
 void PlacePillars();
 
+Wall *PillarWall(int x, int z, int direction);
+int ListWalls(Wall *walls[]);
+void SaveWalls(MazeSnapshot *snapshot);
+void LoadWalls();
+
+
+
+///
+/// Maze region forward declarations ----------------------
+///
+void BuildMazeRegions();
+int WallPassable(Wall *wall);
+void JoinMazeRegions();
+void NumberRegion(int room, int region);
+int InSubtree(int room, int root);
+int TreeChild(int w);
+void AddSpareWall(int w);
+void RemoveSpareWall(int w);
+int CrossingWall(int child, int extraWall);
+int WouldDisconnect(Wall *closingWall, Wall *openingWall);
+void OpenMazeWall(Wall *wall);
+void CloseMazeWall(Wall *wall);
+
 
 
 ///
@@ -159,9 +254,12 @@ void PrintWallGeneration();
 void PrintWallMovement();
 
 int WalkablePiece(int x, int y, int z);
+int FloorLevel(int x, int y, int z);
+void SweepPlayer(float oldPos_x, float oldPos_z, int index_y,
+    float *curPos_x, float *curPos_z);
 int PercentChance(float chance);
 
-int Pillar_WallCount();
+int Pillar_WallCount(int x, int z);
 int CountAllWalls();
 
 
@@ -175,6 +273,31 @@ void mouse(int, int, int, int);
 /* initialize graphics library */
 extern void graphicsInit(int *, char **);
 
+/* milliseconds since the program started */
+extern int getElapsedTime();
+
+/* headless benchmark, run instead of glutMainLoop() */
+extern void runBenchmark();
+
+/* seed for rand(), taken from or stored in the -replay or -record file */
+extern unsigned int replaySeed(unsigned int);
+
+/* solid runs in each column of the world */
+extern int columnSolid(int, int, int, int);
+extern int columnFloor(int, int, int);
+
+/* move a box through the world stopping at cubes */
+extern int sweepBox(float [6], float [3]);
+
+/* flow field mobs follow towards the player */
+extern void flowInit(int, int, int, int, int, int);
+extern void setFlowTarget(int, int);
+
+/* per frame profiler, phases are listed in graphics.h */
+extern void profileBegin(int);
+extern void profileEnd();
+extern void drawProfile();
+
 /* lighting control */
 extern void setLightPosition(GLfloat, GLfloat, GLfloat);
 extern GLfloat* getLightPosition();
@@ -189,6 +312,12 @@ extern void getViewOrientation(float *, float *, float *);
 /* add cube to display list so it will be drawn */
 extern int addDisplayList(int, int, int);
 
+/* change the world, records the area changed so cached geometry is updated */
+extern void setWorldCube(int, int, int, GLubyte);
+extern void fillWorldSpan(int, int, int, int, int, int, GLubyte);
+/* returns the cube at x,y,z, 0 when it is empty or outside the world */
+extern GLubyte getWorldCube(int, int, int);
+
 /* mob controls */
 extern void createMob(int, float, float, float, float);
 extern void setMobPosition(int, float, float, float, float);
@@ -224,13 +353,23 @@ extern int netServer;
 extern int screenWidth, screenHeight;
 /* flag indicates if map is to be printed */
 extern int displayMap;
+/* flag indicates the headless benchmark is running */
+extern int benchmark;
+
+/* world file written once the world is built with -save, and read */
+/* instead of building the world with -load */
+extern char *saveFile;
+extern char *loadFile;
+extern void saveWorld(char *, void *, int);
+/* game state read from the world file by -load */
+extern void *snapshotState;
+extern int snapshotStateSize;
 
 /* frustum corner coordinates, used for visibility determination  */
 extern float corners[4][3];
 
 /* determine which cubes are visible e.g. in view frustum */
 extern void ExtractFrustum();
-extern void tree(float, float, float, float, float, float, int);
 
 
 
@@ -257,6 +396,7 @@ void collisionResponse() {
 
 
 
+    profileBegin(PROFILE_COLLISION);
     deltaGravity = DeltaGravity(lastGravityTime);
 
 
@@ -296,42 +436,39 @@ void collisionResponse() {
     /// Handle: camera moving outside of the gamearea
       if(curIndex_y >= WORLDY - 1){
           curPos_y = (WORLDY - 1) * -1;
-          curIndex_y = curPos_y;
+          curIndex_y = (int)curPos_y * -1;
           currentPiece = WalkablePiece(curIndex_x, curIndex_y, curIndex_z);
       }
 
       if(curIndex_x < 1){
           curPos_x = -1;
-          curIndex_x = curPos_x;
+          curIndex_x = (int)curPos_x * -1;
           currentPiece = WalkablePiece(curIndex_x, curIndex_y, curIndex_z);
       }
       else if(curIndex_x >= MAP_SIZE_X - 2){
           curPos_x = (MAP_SIZE_X - 2) * -1;
-          curIndex_x = curPos_x;
+          curIndex_x = (int)curPos_x * -1;
           currentPiece = WalkablePiece(curIndex_x, curIndex_y, curIndex_z);
       }
 
       if(curIndex_z < 1){
           curPos_z = -1;
-          curIndex_z = curPos_z;
+          curIndex_z = (int)curPos_z * -1;
           currentPiece = WalkablePiece(curIndex_x, curIndex_y, curIndex_z);
       }
       else if(curIndex_z >= MAP_SIZE_Z - 2){
         curPos_z = (MAP_SIZE_Z - 2) * -1;
-        curIndex_z = curPos_z;
+        curIndex_z = (int)curPos_z * -1;
         currentPiece = WalkablePiece(curIndex_x, curIndex_y, curIndex_z);
       }
 
 
-    /// Handle: camera moving sideways into walls
-    if(currentPiece == NOT_WALKABLE){
-
-        if(curIndex_x != oldIndex_x || curIndex_z != oldIndex_z){
-            curPos_x = oldPos_x;
-            curPos_z = oldPos_z;
-        }
-
-    }
+    /// Handle: camera moving sideways into walls, the move is swept from
+    ///         the old position so a fast move cannot pass through a wall
+    ///         and the camera slides along walls instead of stopping
+    SweepPlayer(oldPos_x, oldPos_z, curIndex_y, &curPos_x, &curPos_z);
+    curIndex_x = (int)curPos_x * -1;
+    curIndex_z = (int)curPos_z * -1;
 
 
 
@@ -347,12 +484,7 @@ void collisionResponse() {
 
 
     if(flycontrol == 0){
-        for(floorLevel = curIndex_y; floorLevel > 0; floorLevel--){
-
-            if(WalkablePiece(curIndex_x, floorLevel, curIndex_z) == NOT_WALKABLE){
-                break;
-            }
-        }
+        floorLevel = FloorLevel(curIndex_x, curIndex_y, curIndex_z);
         floorLevel = floorLevel + PLAYER_HEIGHT;
 
         if(floorLevel >= (curPos_y * -1) - deltaGravity){
@@ -381,7 +513,8 @@ void collisionResponse() {
     /// Finish
     ///
     setViewPosition(curPos_x, curPos_y, curPos_z);
-    lastGravityTime = glutGet(GLUT_ELAPSED_TIME);
+    lastGravityTime = getElapsedTime();
+    profileEnd();
 }
 
 
@@ -395,6 +528,9 @@ void draw2D() {
     GLfloat green[] = {0.0, 0.5, 0.0, 0.5};
     GLfloat black[] = {0.0, 0.0, 0.0, 0.5};
 
+    /* frame time graph drawn when -profile is used */
+    drawProfile();
+
     if (testWorld) {
         /* draw some sample 2d shapes */
         set2Dcolour(green);
@@ -474,15 +610,18 @@ void update() {
 
     } else {
         int currentElapsedTime, deltaWallChangeTime;
+        float viewPos_x, viewPos_y, viewPos_z;
 
         if(AUTO_CHANGE_WALLS){
-            currentElapsedTime = glutGet(GLUT_ELAPSED_TIME);
+            currentElapsedTime = getElapsedTime();
             deltaWallChangeTime = currentElapsedTime - lastUpdateTime;
 
             lastWallChangeTime += deltaWallChangeTime;
 
 
+            profileBegin(PROFILE_WALLS);
             AnimateWalls(deltaWallChangeTime);
+            profileEnd();
 
 
             if(lastWallChangeTime >= CHANGE_WALLS_TIME_MS){
@@ -490,12 +629,22 @@ void update() {
                 ChangeWalls();
             }
 
-            lastUpdateTime = glutGet(GLUT_ELAPSED_TIME);
+            lastUpdateTime = getElapsedTime();
         }
 
 
 
         collisionResponse();
+
+
+        ///
+        /// Mobs seeking the player follow the flow field to the cell the
+        ///      player is standing in. The maze has no mobs of its own, so
+        ///      tickMobs() leaves the field alone until one is made to seek
+        ///      with seekMob()
+        ///
+        getViewPosition(&viewPos_x, &viewPos_y, &viewPos_z);
+        setFlowTarget((int)viewPos_x * -1, (int)viewPos_z * -1);
     }
 }
 
@@ -526,7 +675,7 @@ void mouse(int button, int state, int x, int y) {
 
 int main(int argc, char** argv)
 {
-    int i, j, k;
+    int i, j;
     /* initialize the graphics system */
     graphicsInit(&argc, argv);
 
@@ -536,36 +685,39 @@ int main(int argc, char** argv)
     /* Put your code in the else statment below */
     /* The testworld is only guaranteed to work with a world of
     with dimensions of 100,50,100. */
-    if (testWorld == 1) {
+    if ((testWorld == 1) && (loadFile == NULL)) {
         /* initialize world to empty */
-        for(i=0; i<WORLDX; i++)
-        for(j=0; j<WORLDY; j++)
-        for(k=0; k<WORLDZ; k++)
-        world[i][j][k] = 0;
+        fillWorldSpan(0, 0, 0, WORLDX, WORLDY, WORLDZ, 0);
 
         /* some sample objects */
         /* build a red platform */
         for(i=0; i<WORLDX; i++) {
             for(j=0; j<WORLDZ; j++) {
-                world[i][24][j] = 3;
+                setWorldCube(i, 24, j, 3);
             }
         }
         /* create some green and blue cubes */
-        world[50][25][50] = 1;
-        world[49][25][50] = 1;
-        world[49][26][50] = 1;
-        world[52][25][52] = 2;
-        world[52][26][52] = 2;
+        setWorldCube(50, 25, 50, 1);
+        setWorldCube(49, 25, 50, 1);
+        setWorldCube(49, 26, 50, 1);
+        setWorldCube(52, 25, 52, 2);
+        setWorldCube(52, 26, 52, 2);
 
         /* blue box shows xy bounds of the world */
         for(i=0; i<WORLDX-1; i++) {
-            world[i][25][0] = 2;
-            world[i][25][WORLDZ-1] = 2;
+            setWorldCube(i, 25, 0, 2);
+            setWorldCube(i, 25, WORLDZ-1, 2);
         }
         for(i=0; i<WORLDZ-1; i++) {
-            world[0][25][i] = 2;
-            world[WORLDX-1][25][i] = 2;
+            setWorldCube(0, 25, i, 2);
+            setWorldCube(WORLDX-1, 25, i, 2);
         }
+    }
+
+    if (testWorld == 1) {
+        /* the world is written before the mobs are added */
+        if (saveFile != NULL)
+            saveWorld(saveFile, NULL, 0);
 
         /* create two sample mobs */
         /* these are animated in the update() function */
@@ -575,6 +727,10 @@ int main(int argc, char** argv)
         /* create sample player */
         createPlayer(0, 52.0, 27.0, 52.0, 0.0);
 
+        /* the test world does not use rand() but -record and -replay */
+        /* still open their files here */
+        replaySeed(0);
+
     } else {
 
         ///
@@ -585,9 +741,16 @@ int main(int argc, char** argv)
         flycontrol = 0;
 
         ///
-        /// initialize random
+        /// initialize random, the benchmark uses a fixed seed so every
+        ///            run builds and changes the maze the same way, a
+        ///            recording stores the seed and a replay reuses it
         ///
-        srand((unsigned) time(NULL));
+        if(benchmark){
+            srand(replaySeed(1));
+        }
+        else{
+            srand(replaySeed((unsigned) time(NULL)));
+        }
 
         ///
         /// Set lastUpdateTime to zero
@@ -599,39 +762,73 @@ int main(int argc, char** argv)
 
 
         ///
-        /// Build the initial world
+        /// Load the world and the walls saved with it, the walls are set
+        ///      up first so the random numbers used afterwards are the
+        ///      same as when the world is built
         ///
-        BuildWorldShell();
-        PlacePillars();
-        SetupWalls();
-        PrintWallGeneration();
-        PlaceWalls(0);
+        if(loadFile != NULL){
+            SetupWalls();
+            LoadWalls();
+            BuildMazeRegions();
+            PrintWallGeneration();
+        }
+        else{
+            ///
+            /// Build the initial world
+            ///
+            BuildWorldShell();
+            PlacePillars();
+            SetupWalls();
+            BuildMazeRegions();
+            JoinMazeRegions();
+            PrintWallGeneration();
+            PlaceWalls(0);
 
-        printf("Wall count: %d\n", CountAllWalls());
+            ///
+            /// Setup some cubes to climb up for testing
+            ///
+            setWorldCube(3, 1, 2, 5);
+
+            setWorldCube(2, 1, 2, 5);
+            setWorldCube(2, 2, 2, 5);
+
+            setWorldCube(2, 1, 3, 5);
+            setWorldCube(2, 2, 3, 5);
+            setWorldCube(2, 3, 3, 5);
+
+            setWorldCube(3, 1, 3, 5);
+            setWorldCube(3, 2, 3, 5);
+            setWorldCube(3, 3, 3, 5);
+            setWorldCube(3, 4, 3, 5);
+
+            setWorldCube(3, 1, 4, 5);
+            setWorldCube(3, 2, 4, 5);
+            setWorldCube(3, 3, 4, 5);
+            setWorldCube(3, 4, 4, 5);
+            setWorldCube(3, 5, 4, 5);
+        }
 
 
         ///
-        /// Setup some cubes to climb up for testing
+        /// Write the world and the walls when -save is used
         ///
-        world[3][1][2] = 5;
+        if(saveFile != NULL){
+            MazeSnapshot snapshot;
 
-        world[2][1][2] = 5;
-        world[2][2][2] = 5;
+            SaveWalls(&snapshot);
+            saveWorld(saveFile, &snapshot, sizeof(snapshot));
+        }
 
-        world[2][1][3] = 5;
-        world[2][2][3] = 5;
-        world[2][3][3] = 5;
+        printf("Wall count: %d\n", CountAllWalls());
 
-        world[3][1][3] = 5;
-        world[3][2][3] = 5;
-        world[3][3][3] = 5;
-        world[3][4][3] = 5;
+        printf("Maze regions: %d\n", regionCount);
 
-        world[3][1][4] = 5;
-        world[3][2][4] = 5;
-        world[3][3][4] = 5;
-        world[3][4][4] = 5;
-        world[3][5][4] = 5;
+
+        ///
+        /// Paths through the maze for mobs, over the cells the player
+        ///       could stand in on the floor
+        ///
+        flowInit(0, 0, MAP_SIZE_X, MAP_SIZE_Z, 1, PLAYER_HEIGHT);
 
     }
 
@@ -640,8 +837,10 @@ int main(int argc, char** argv)
 
     /* starts the graphics processing loop */
     /* code after this will not run until the program exits */
-    glutMainLoop();
-    FreeWalls();
+    if (benchmark == 1)
+        runBenchmark();
+    else
+        glutMainLoop();
     return 0;
 }
 
@@ -660,46 +859,24 @@ int main(int argc, char** argv)
 void BuildWorldShell(){
 /// Builds the floor, the outer walls, and the pillars.
 
-    int x, y, z;
-    int height;
-
     ///
     /// Initialize world to empty
     ///
-    for(x=0; x<WORLDX; x++){
-        for(y=0; y<WORLDY; y++){
-            for(z=0; z<WORLDZ; z++){
-                world[x][y][z] = 0;
-            }
-        }
-    }
+    fillWorldSpan(0, 0, 0, WORLDX, WORLDY, WORLDZ, 0);
 
 
     ///
     /// Build the floor
     ///
-    for(x=0; x < MAP_SIZE_X - 1; x++) {
-        for(z=0; z < MAP_SIZE_Z - 1; z++) {
-            world[x][0][z] = FLOOR_COLOUR;
-        }
-    }
+    fillWorldSpan(0, 0, 0, MAP_SIZE_X - 1, 1, MAP_SIZE_Z - 1, FLOOR_COLOUR);
 
     ///
     /// Build the outer walls
     ///
-    for(height = 0; height < WALL_HEIGHT; height++){
-
-        for(x=0; x < MAP_SIZE_X - 1; x++) {
-            world[x][1 + height][0] = OUTER_WALL_COLOUR;
-            world[x][1 + height][MAP_SIZE_Z-2] = OUTER_WALL_COLOUR;
-        }
-
-        for(z=0; z < MAP_SIZE_Z - 1; z++) {
-            world[0][1 + height][z] = OUTER_WALL_COLOUR;
-            world[MAP_SIZE_X-2][1 + height][z] = OUTER_WALL_COLOUR;
-        }
-
-    }
+    fillWorldSpan(0, 1, 0, MAP_SIZE_X - 1, 1 + WALL_HEIGHT, 1, OUTER_WALL_COLOUR);
+    fillWorldSpan(0, 1, MAP_SIZE_Z - 2, MAP_SIZE_X - 1, 1 + WALL_HEIGHT, MAP_SIZE_Z - 1, OUTER_WALL_COLOUR);
+    fillWorldSpan(0, 1, 0, 1, 1 + WALL_HEIGHT, MAP_SIZE_Z - 1, OUTER_WALL_COLOUR);
+    fillWorldSpan(MAP_SIZE_X - 2, 1, 0, MAP_SIZE_X - 1, 1 + WALL_HEIGHT, MAP_SIZE_Z - 1, OUTER_WALL_COLOUR);
 
 
 }
@@ -710,7 +887,7 @@ void BuildWorldShell(){
 /// PlacePillars
 ///
 void PlacePillars(){
-    int x, z, height;
+    int x, z;
 
     ///
     /// Create the pillars
@@ -718,9 +895,9 @@ void PlacePillars(){
     for(x = 0; x < WALL_COUNT_X + 1; x++){
         for(z = 0; z < WALL_COUNT_Z + 1; z++){
 
-            for(height = 0; height < WALL_HEIGHT; height++){
-                world[x * (WALL_LENGTH + 1)][1 + height][z * (WALL_LENGTH + 1)] = PILLAR_COLOUR;
-            }
+            fillWorldSpan(x * (WALL_LENGTH + 1), 1, z * (WALL_LENGTH + 1),
+                          x * (WALL_LENGTH + 1) + 1, 1 + WALL_HEIGHT, z * (WALL_LENGTH + 1) + 1,
+                          PILLAR_COLOUR);
 
         }
     }
@@ -750,69 +927,44 @@ void SetupWalls(){
     genInfo.creationAttempts = 0;
     genInfo.wallsCreated = 0;
 
-    wallCount = ((WALL_COUNT_X - 1) * WALL_COUNT_Z) + (WALL_COUNT_X * (WALL_COUNT_Z - 1));
+    wallCount = MAZE_WALL_COUNT;
     genInfo.spawnChance = (TARGET_WALL_COUNT * 100) / wallCount;
 
 
     ///
-    /// Set pillars to null
+    /// Each wall is set up by the first pillar it touches, a pillar's north
+    ///      wall is the south wall of the pillar before it unless it is in
+    ///      the first row, and the same for its west wall and the first
+    ///      column
     ///
-    for(x = 0; x < WALL_COUNT_X; x++){
-        for(z = 0; z < WALL_COUNT_Z; z++){
-            pillars[x][z].wall[north] = NULL;
-            pillars[x][z].wall[south] = NULL;
-            pillars[x][z].wall[east] = NULL;
-            pillars[x][z].wall[west] = NULL;
-        }
-    }
-
-
     for(x = 0; x < WALL_COUNT_X - 1; x++){
         for(z = 0; z < WALL_COUNT_Z - 1; z++){
 
             ///
             /// North wall
             ///
-            if(z > 0){
-                SetupWall( &(pillars[x][z].wall[north]), &(pillars[x][z - 1].wall[south]), &genInfo, x, z);
-            }
-            else{
-                SetupWall( &(pillars[x][z].wall[north]), NULL, &genInfo, x, z);
+            if(z == 0){
+                SetupWall(PillarWall(x, z, north), &genInfo, x, z);
             }
 
 
             ///
             /// South wall
             ///
-            if(z < WALL_COUNT_Z - 2){
-                SetupWall( &(pillars[x][z].wall[south]), &(pillars[x][z + 1].wall[north]), &genInfo, x, z);
-            }
-            else{
-                SetupWall( &(pillars[x][z].wall[south]), NULL, &genInfo, x, z);
-            }
+            SetupWall(PillarWall(x, z, south), &genInfo, x, z);
 
 
             ///
             /// East Wall
             ///
-            if(x < WALL_COUNT_X - 1){
-                SetupWall( &(pillars[x][z].wall[east]), &(pillars[x + 1][z].wall[west]), &genInfo, x, z);
-
-            }
-            else{
-                SetupWall( &(pillars[x][z].wall[east]), NULL, &genInfo, x, z);
-            }
+            SetupWall(PillarWall(x, z, east), &genInfo, x, z);
 
 
             ///
             /// West Wall
             ///
-            if(x > 0){
-                SetupWall( &(pillars[x][z].wall[west]), &(pillars[x - 1][z].wall[east]), &genInfo, x, z);
-
-            }
-            else{
-                SetupWall( &(pillars[x][z].wall[west]), NULL, &genInfo, x, z);
+            if(x == 0){
+                SetupWall(PillarWall(x, z, west), &genInfo, x, z);
             }
 
 
@@ -822,33 +974,117 @@ void SetupWalls(){
 
     }
 
-    pillars[0][0].wall[west]->state = open;
+    PillarWall(0, 0, west)->state = open;
 
 }
 
 
 ///
-/// FreeWalls ---------------------------------------------
+/// PillarWall --------------------------------------------
 ///
-void FreeWalls(){
-/// Goes through all the walls, and frees them.
+Wall *PillarWall(int x, int z, int direction){
+/// Returns the wall on the "direction" side of the pillar at "x", "z". The
+///         north and south walls of a pillar are next to each other in its
+///         column of z-axis walls, the west and east walls next to each
+///         other in its row of x-axis walls.
+
+    if(direction == north){
+        return &mazeWall[x * WALL_COUNT_Z + z];
+    }
+    if(direction == south){
+        return &mazeWall[x * WALL_COUNT_Z + z + 1];
+    }
+    if(direction == west){
+        return &mazeWall[Z_WALL_COUNT + z * WALL_COUNT_X + x];
+    }
+    return &mazeWall[Z_WALL_COUNT + z * WALL_COUNT_X + x + 1];
+}
+
 
-    int x, z;
 
+///
+/// ListWalls ---------------------------------------------
+///
+int ListWalls(Wall *walls[]){
+/// Fills "walls" with every wall, each listed once in the order PlaceWalls
+///       places them. Returns the number of walls.
+
+    int x, z, count;
+
+    count = 0;
     for(x = 0; x < WALL_COUNT_X - 1; x++){
         for(z = 0; z < WALL_COUNT_Z - 1; z++){
             if(x == 0){
-                free(pillars[z][x].wall[west]);
+                walls[count++] = PillarWall(x, z, west);
             }
             if(z == 0){
-                free(pillars[z][x].wall[north]);
+                walls[count++] = PillarWall(x, z, north);
             }
 
-            free(pillars[z][x].wall[east]);
-            free(pillars[z][x].wall[south]);
+            walls[count++] = PillarWall(x, z, east);
+            walls[count++] = PillarWall(x, z, south);
         }
     }
 
+    return count;
+}
+
+
+
+///
+/// SaveWalls ---------------------------------------------
+///
+void SaveWalls(MazeSnapshot *snapshot){
+/// Copies the state of every wall and the wall being moved into "snapshot"
+///       so it can be written to a world file.
+
+    Wall *walls[MAZE_WALL_COUNT];
+    int i;
+
+    memset(snapshot, 0, sizeof(MazeSnapshot));
+    snapshot->wallCount = ListWalls(walls);
+    for(i = 0; i < snapshot->wallCount; i++){
+        snapshot->wallState[i] = walls[i]->state;
+    }
+
+    snapshot->movingPillar_x = movingPillar_x;
+    snapshot->movingPillar_z = movingPillar_z;
+    snapshot->closingWall = closingWall;
+    snapshot->openingWall = openingWall;
+    snapshot->wallPercent = wallPercent;
+    snapshot->lastWallChangeTime = lastWallChangeTime;
+}
+
+
+
+///
+/// LoadWalls ---------------------------------------------
+///
+void LoadWalls(){
+/// Sets the walls created by SetupWalls to the state read from the world
+///      file. The cubes of the walls are already in the world file so
+///      PlaceWalls is not needed.
+
+    MazeSnapshot *snapshot;
+    Wall *walls[MAZE_WALL_COUNT];
+    int i;
+
+    snapshot = (MazeSnapshot *) snapshotState;
+    if(snapshotStateSize != sizeof(MazeSnapshot) || snapshot->wallCount != ListWalls(walls)){
+        printf("ERROR: the world file does not contain a maze with %d walls\n", MAZE_WALL_COUNT);
+        exit(1);
+    }
+
+    for(i = 0; i < snapshot->wallCount; i++){
+        walls[i]->state = snapshot->wallState[i];
+    }
+
+    movingPillar_x = snapshot->movingPillar_x;
+    movingPillar_z = snapshot->movingPillar_z;
+    closingWall = snapshot->closingWall;
+    openingWall = snapshot->openingWall;
+    wallPercent = snapshot->wallPercent;
+    lastWallChangeTime = snapshot->lastWallChangeTime;
 }
 
 
@@ -865,20 +1101,11 @@ void PlaceVerticalWall(Wall *wall, int wallX, int wallZ, int deltaTime){
 /// Uses "deltaTime" to figure out how much an opening or closing wall should be
 ///      change in length, which results in the walls appearing to be animated.
 
-    int yOffset, z;
-
     ///
     /// Place the wall
     ///
-    for(yOffset = 0; yOffset < WALL_HEIGHT; yOffset++){
-        for(z = 0; z < WALL_LENGTH; z++){
-
-            if(wall->state == closed){
-                world[wallX][1 + yOffset][wallZ + z] = INNER_WALL_COLOUR;
-            }
-
-        }
-
+    if(wall->state == closed){
+        fillWorldSpan(wallX, 1, wallZ, wallX + 1, 1 + WALL_HEIGHT, wallZ + WALL_LENGTH, INNER_WALL_COLOUR);
     }
 
 
@@ -897,22 +1124,11 @@ void PlaceHorizontalWall(Wall *wall, int wallX, int wallZ, int deltaTime){
 /// Uses "deltaTime" to figure out how much an opening or closing wall should be
 ///      change in length, which results in the walls appearing to be animated.
 
-    int yOffset, x;
-
-
     ///
     /// Place the wall
     ///
-    for(yOffset = 0; yOffset < WALL_HEIGHT; yOffset++){
-        for(x = 0; x < WALL_LENGTH; x++){
-
-            if(wall->state == closed){
-                world[wallX + x][1 + yOffset][wallZ] = INNER_WALL_COLOUR;
-            }
-
-        }
-
-
+    if(wall->state == closed){
+        fillWorldSpan(wallX, 1, wallZ, wallX + WALL_LENGTH, 1 + WALL_HEIGHT, wallZ + 1, INNER_WALL_COLOUR);
     }
 
 
@@ -931,14 +1147,14 @@ void PlaceWalls(int deltaTime){
     for(x = 0; x < WALL_COUNT_X - 1; x++){
         for(z = 0; z < WALL_COUNT_Z - 1; z++){
             if(x == 0){
-                PlaceHorizontalWall(pillars[x][z].wall[west], 1, (WALL_LENGTH + 1) * (z + 1), deltaTime);
+                PlaceHorizontalWall(PillarWall(x, z, west), 1, (WALL_LENGTH + 1) * (z + 1), deltaTime);
             }
             if(z == 0){
-                PlaceVerticalWall(pillars[x][z].wall[north], (WALL_LENGTH + 1) * (x + 1), 1, deltaTime);
+                PlaceVerticalWall(PillarWall(x, z, north), (WALL_LENGTH + 1) * (x + 1), 1, deltaTime);
             }
 
-            PlaceHorizontalWall(pillars[x][z].wall[east], (x + 1) * (WALL_LENGTH + 1) + 1, (WALL_LENGTH + 1) * (z + 1), deltaTime);
-            PlaceVerticalWall(pillars[x][z].wall[south], (WALL_LENGTH + 1) * (x + 1), (z + 1) * (WALL_LENGTH + 1) + 1, deltaTime);
+            PlaceHorizontalWall(PillarWall(x, z, east), (x + 1) * (WALL_LENGTH + 1) + 1, (WALL_LENGTH + 1) * (z + 1), deltaTime);
+            PlaceVerticalWall(PillarWall(x, z, south), (WALL_LENGTH + 1) * (x + 1), (z + 1) * (WALL_LENGTH + 1) + 1, deltaTime);
         }
     }
 
@@ -955,30 +1171,23 @@ void ChangeWalls(){
 /// STEPS:
 /// 1. Setup variables, clear variables.
 /// 2. Pick a random pillar.
-/// 3. For the picked pillar: create a closedWall list, and a openWall list.
-/// 4. Pick a random closed wall, from the closedWall list.
-/// 5. Pick a random open wall, from the openWall list.
-/// 6. Set the selected closed wall to open
-/// 7. Set the selected open wall to close
+/// 3. Pick a closed wall and an open wall of the pillar with PickPillarWalls,
+///    if every pair would split a region of the maze pick another pillar.
+/// 4. Set the selected closed wall to open
+/// 5. Set the selected open wall to close
 
     ///
     /// 1. Setup variables, clear variables
     ///
-    int randOpenWall = -1, randClosedWall = -1;
     int randX, randZ;
+    int lastPillar_x, lastPillar_z, lastOpening, lastClosing;
     int y;
-
-
-    int openWallCount = 0, closedWallCount = 0;
-    int openWalls[4], closedWalls[4];
     int i;
 
-    Pillar *currentPillar;
-
-    for(i = 0; i < 4; i++){
-        openWalls[i] = -1;
-        closedWalls[i] = -1;
-    }
+    lastPillar_x = movingPillar_x;
+    lastPillar_z = movingPillar_z;
+    lastOpening = openingWall;
+    lastClosing = closingWall;
 
     movingPillar_x = -1;
     movingPillar_z = -1;
@@ -1008,44 +1217,102 @@ void ChangeWalls(){
         }
 
 
-        currentPillar = &(pillars[randX][randZ]);
         movingPillar_x = randX;
         movingPillar_z = randZ;
 
 
-        if(Pillar_WallCount(currentPillar) != 0 && Pillar_WallCount(currentPillar) != 4){
-            break;
+        if(Pillar_WallCount(randX, randZ) != 0 && Pillar_WallCount(randX, randZ) != 4){
+
+            ///
+            /// 3. Pick the walls to open / close
+            ///
+            if(PickPillarWalls(randX, randZ, &openingWall, &closingWall)){
+                break;
+            }
         }
 
         i++;
         if(i > 1000){
-            printf("!-!-! ERROR: was unable to randomly pick a valid pillar (within 1000 random picks) for wall movement... Wallcount(%d)\n", Pillar_WallCount(currentPillar));
+            printf("!-!-! ERROR: was unable to randomly pick a valid pillar (within 1000 random picks) for wall movement... Wallcount(%d)\n", Pillar_WallCount(randX, randZ));
+
+            ///
+            /// Leave the last walls moved where they finished
+            ///
+            movingPillar_x = lastPillar_x;
+            movingPillar_z = lastPillar_z;
+            openingWall = lastOpening;
+            closingWall = lastClosing;
             return;
         }
     }
 
 
 
+    ///
+    /// 4. / 5. Start opening and closing the walls
+    ///
+    PillarWall(movingPillar_x, movingPillar_z, openingWall)->state = opening;
+    PillarWall(movingPillar_x, movingPillar_z, closingWall)->state = closing;
+    OpenMazeWall(PillarWall(movingPillar_x, movingPillar_z, openingWall));
+    CloseMazeWall(PillarWall(movingPillar_x, movingPillar_z, closingWall));
+
+    wallPercent = 0;
+
+    PrintWallMovement();
+
+
+    PlacePillars();
+    for(y = 0; y < WALL_HEIGHT; y++){
+        setWorldCube((movingPillar_x + 1) * (WALL_LENGTH + 1), y + 1, (movingPillar_z + 1) * (WALL_LENGTH + 1), OUTER_WALL_COLOUR);
+    }
+}
+
+
+
+///
+/// PickPillarWalls ---------------------------------------
+///
+int PickPillarWalls(int pillar_x, int pillar_z, int *pickedOpening, int *pickedClosing){
+/// Picks a closed wall of the pillar at "pillar_x", "pillar_z" to open and an
+///       open wall to close.
+///       Returns 0 if every pair would split a region of the maze.
+/// STEPS:
+/// 1. For the pillar: create a closedWall list, and a openWall list.
+/// 2. Pick a random closed wall, from the closedWall list.
+/// 3. Pick a random open wall, from the openWall list.
+/// 4. If closing the open wall would split a region, try the other pairs
+///    starting from the random ones.
+
+    int randOpenWall = -1, randClosedWall = -1;
 
+    int openWallCount = 0, closedWallCount = 0;
+    int openWalls[4], closedWalls[4];
+    int i, j, o, c;
 
+    Wall *pillarWall[4];
 
+    for(i = 0; i < 4; i++){
+        openWalls[i] = -1;
+        closedWalls[i] = -1;
+        pillarWall[i] = PillarWall(pillar_x, pillar_z, i);
+    }
 
 
 
     ///
-    /// 3. For the current pillar: create a list of open walls, and a list of
+    /// 1. For the current pillar: create a list of open walls, and a list of
     ///        closed walls.
     ///    Track how the adjacent pillars should be affected for each wall on
     ///          each list (as most walls are attached to two pillars).
     ///
 
 
-    if(currentPillar->wall[north]->state == closed){
+    if(pillarWall[north]->state == closed){
         closedWalls[closedWallCount] = north;
 
         closedWallCount++;
     }
-    else if(currentPillar->wall[north]->state == open){
+    else if(pillarWall[north]->state == open){
         openWalls[openWallCount] = north;
 
         openWallCount++;
@@ -1053,12 +1320,12 @@ void ChangeWalls(){
 
 
 
-    if(currentPillar->wall[south]->state == closed){
+    if(pillarWall[south]->state == closed){
         closedWalls[closedWallCount] = south;
 
         closedWallCount++;
     }
-    else if(currentPillar->wall[south]->state == open){
+    else if(pillarWall[south]->state == open){
         openWalls[openWallCount] = south;
 
         openWallCount++;
@@ -1066,24 +1333,24 @@ void ChangeWalls(){
 
 
 
-    if(currentPillar->wall[east]->state == closed){
+    if(pillarWall[east]->state == closed){
         closedWalls[closedWallCount] = east;
 
         closedWallCount++;
     }
-    else if(currentPillar->wall[east]->state == open){
+    else if(pillarWall[east]->state == open){
         openWalls[openWallCount] = east;
 
         openWallCount++;
     }
 
 
-    if(currentPillar->wall[west]->state == closed){
+    if(pillarWall[west]->state == closed){
         closedWalls[closedWallCount] = west;
 
         closedWallCount++;
     }
-    else if(currentPillar->wall[west]->state == open){
+    else if(pillarWall[west]->state == open){
         openWalls[openWallCount] = west;
 
         openWallCount++;
@@ -1092,36 +1359,32 @@ void ChangeWalls(){
 
 
     ///
-    /// Pick the walls to open / close
+    /// 2. / 3. Pick the walls to open / close
     ///
-    //if(closedWallCount > 0){
-        randClosedWall = rand() % closedWallCount;
-    //}
-
-
-    //if(openWallCount > 0){
-        randOpenWall = rand() % openWallCount;
-    //}
-
-
+    randClosedWall = rand() % closedWallCount;
+    randOpenWall = rand() % openWallCount;
 
 
-    openingWall = closedWalls[randClosedWall];
-    //openingWall = north; //TODO: for debugging
-    closingWall = openWalls[randOpenWall];
 
-    pillars[movingPillar_x][movingPillar_z].wall[openingWall]->state = opening;
-    pillars[movingPillar_x][movingPillar_z].wall[closingWall]->state = closing;
-
-    wallPercent = 0;
-
-    PrintWallMovement();
+    ///
+    /// 4. Keep the first pair which leaves every region joined
+    ///
+    for(i = 0; i < closedWallCount; i++){
+        c = closedWalls[(randClosedWall + i) % closedWallCount];
 
+        for(j = 0; j < openWallCount; j++){
+            o = openWalls[(randOpenWall + j) % openWallCount];
 
-    PlacePillars();
-    for(y = 0; y < WALL_HEIGHT; y++){
-        world[(movingPillar_x + 1) * (WALL_LENGTH + 1)][y + 1][(movingPillar_z + 1) * (WALL_LENGTH + 1)] = OUTER_WALL_COLOUR;
+            if(!WouldDisconnect(pillarWall[o], pillarWall[c])){
+                *pickedOpening = c;
+                *pickedClosing = o;
+                return 1;
+            }
+            vetoedMoves++;
+        }
     }
+
+    return 0;
 }
 
 
@@ -1129,35 +1392,15 @@ void ChangeWalls(){
 ///
 /// SetupWall ---------------------------------------------
 ///
-void SetupWall(Wall **targetWall, Wall **adjacentWall, GenerationInfo *genInfo, int x, int z){
-/// Mallocs memory for a wall. Then randomly decides if that wall should be
-///         created opened or closed. Tracks whether a wall was created opened
-///         or closed using the genInfo struct passed in.
+void SetupWall(Wall *wall, GenerationInfo *genInfo, int x, int z){
+/// Randomly decides if a wall should be created opened or closed. Tracks
+///         whether a wall was created opened or closed using the genInfo
+///         struct passed in. "x" and "z" are the pillar setting it up.
 
     float currentSpawnPercentage;
 
-    ///
-    /// Error checking
-    ///
-    if(targetWall == NULL){
-        printf("!-!-! ERROR: pointer to targetWall-pointer was null\n");
-        return;
-    }
-
-    ///
-    /// Make sure we're not going to spawn a wall where a wall exists already
-    ///
-    if(*targetWall != NULL){
-        return;
-    }
-
-
-    ///
-    /// Malloc the new wall
-    ///
-    Wall *newWall = (Wall*)malloc(sizeof(Wall));
-    newWall->x = x;
-    newWall->z = z;
+    wall->x = x;
+    wall->z = z;
 
     genInfo->creationAttempts++;
 
@@ -1166,32 +1409,20 @@ void SetupWall(Wall **targetWall, Wall **adjacentWall, GenerationInfo *genInfo,
     /// Randomly decide if the wall should be open or closed
     ///
     if(PercentChance(genInfo->spawnChance + genInfo->spawnChanceModifier) && genInfo->wallsCreated < MAX_WALL_COUNT){
-        newWall->state = closed;
+        wall->state = closed;
         genInfo->wallsCreated++;
     }
     else{
-        newWall->state = open;
+        wall->state = open;
     }
 
-    //newWall->state = closed;//TODO: this is for debugging
+    //wall->state = closed;//TODO: this is for debugging
 
     ///
     /// Use the spawnChanceModifier to push the spawnChance
     ///         towards spawning the target number of walls
     currentSpawnPercentage = (100 * ((float)genInfo->wallsCreated / (float)genInfo->creationAttempts));
     genInfo->spawnChanceModifier = genInfo->spawnChance - currentSpawnPercentage;
-
-
-
-
-    ///
-    /// Assign the new wall
-    ///
-    *targetWall = newWall;
-
-    if(adjacentWall != NULL && *adjacentWall == NULL){
-        *adjacentWall = newWall;
-    }
 }
 
 
@@ -1201,17 +1432,26 @@ void SetupWall(Wall **targetWall, Wall **adjacentWall, GenerationInfo *genInfo,
 ///
 void AnimateWalls(int deltaTime){
 /// Moves the walls: ...
-    Pillar *selectedPillar;
+    Wall *selectedWall[4];
 
     int startX, startZ;
     int cur_x, cur_z;
     int actualLength;
-    int y;
+    int y, i;
 
     float deltaPercent;
 
 
-    selectedPillar = &(pillars[movingPillar_x][movingPillar_z]);
+    ///
+    /// Nothing is moving until the first ChangeWalls
+    ///
+    if(openingWall < 0 || openingWall == closingWall){
+        return;
+    }
+
+    for(i = 0; i < 4; i++){
+        selectedWall[i] = PillarWall(movingPillar_x, movingPillar_z, i);
+    }
 
 
     deltaPercent = (((float)deltaTime * 2) / (float)CHANGE_WALLS_TIME_MS) * 100;
@@ -1223,9 +1463,8 @@ void AnimateWalls(int deltaTime){
     if(wallPercent > 100)
     {
         wallPercent = 100;
-        selectedPillar->wall[openingWall]->state = open;
-        selectedPillar->wall[closingWall]->state = closed;
-
+        selectedWall[openingWall]->state = open;
+        selectedWall[closingWall]->state = closed;
     }
 
     actualLength = (WALL_LENGTH * wallPercent) / 100;
@@ -1238,30 +1477,30 @@ void AnimateWalls(int deltaTime){
       ///
       /// Close wall
       ///
-      startX = (selectedPillar->wall[closingWall]->x + 1) * (WALL_LENGTH + 1);
-      startZ = (selectedPillar->wall[closingWall]->z + 1) * (WALL_LENGTH + 1);
+      startX = (selectedWall[closingWall]->x + 1) * (WALL_LENGTH + 1);
+      startZ = (selectedWall[closingWall]->z + 1) * (WALL_LENGTH + 1);
 
       if(closingWall == north){
 
           for(cur_z = 0; cur_z < actualLength; cur_z++){
-              world[startX][1 + y][startZ - cur_z + WALL_LENGTH] = INNER_WALL_COLOUR;
+              setWorldCube(startX, 1 + y, startZ - cur_z + WALL_LENGTH, INNER_WALL_COLOUR);
           }
       }
       if(closingWall == east){
 
           for(cur_x = 0; cur_x < actualLength; cur_x++){
-              world[startX + cur_x + 1][1 + y][startZ] = INNER_WALL_COLOUR;
+              setWorldCube(startX + cur_x + 1, 1 + y, startZ, INNER_WALL_COLOUR);
           }
       }
       if(closingWall == south){
 
           for(cur_z = 0; cur_z < actualLength; cur_z++){
-              world[startX][1 + y][startZ + cur_z + 1] = INNER_WALL_COLOUR;
+              setWorldCube(startX, 1 + y, startZ + cur_z + 1, INNER_WALL_COLOUR);
           }
       }
       if(closingWall == west){
           for(cur_x = 0; cur_x < actualLength; cur_x++){
-              world[startX - cur_x - 1][1 + y][startZ] = INNER_WALL_COLOUR;
+              setWorldCube(startX - cur_x - 1, 1 + y, startZ, INNER_WALL_COLOUR);
           }
       }
 
@@ -1269,31 +1508,31 @@ void AnimateWalls(int deltaTime){
       ///
       /// Open wall
       ///
-      startX = (selectedPillar->wall[openingWall]->x + 1) * (WALL_LENGTH + 1);
-      startZ = (selectedPillar->wall[openingWall]->z + 1) * (WALL_LENGTH + 1);
+      startX = (selectedWall[openingWall]->x + 1) * (WALL_LENGTH + 1);
+      startZ = (selectedWall[openingWall]->z + 1) * (WALL_LENGTH + 1);
 
       if(openingWall == north){
 
           for(cur_z = 0; cur_z < actualLength; cur_z++){
-              world[startX][1 + y][startZ + cur_z + 1] = 0;
+              setWorldCube(startX, 1 + y, startZ + cur_z + 1, 0);
           }
       }
       if(openingWall == east){
 
           for(cur_x = 0; cur_x < actualLength; cur_x++){
-              world[startX - cur_x + WALL_LENGTH][1 + y][startZ] = 0;
+              setWorldCube(startX - cur_x + WALL_LENGTH, 1 + y, startZ, 0);
           }
 
       }
       if(openingWall == south){
 
           for(cur_z = 0; cur_z < actualLength; cur_z++){
-              world[startX][1 + y][startZ - cur_z + WALL_LENGTH] = 0;
+              setWorldCube(startX, 1 + y, startZ - cur_z + WALL_LENGTH, 0);
           }
       }
       if(openingWall == west){
           for(cur_x = 0; cur_x < actualLength; cur_x++){
-              world[startX + cur_x + 1][1 + y][startZ] = 0;
+              setWorldCube(startX + cur_x + 1, 1 + y, startZ, 0);
           }
 
       }
@@ -1303,6 +1542,358 @@ void AnimateWalls(int deltaTime){
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+/////
+///// Maze Region Functions ====================================================
+/////
+
+
+
+///
+/// BuildMazeRegions --------------------------------------
+///
+void BuildMazeRegions(){
+/// Finds the two rooms each wall is between, then labels the regions of rooms
+///       joined by open walls and marks their tree walls by searching out
+///       from every room which is not labelled yet. Called once the walls are
+///       set up or loaded, OpenMazeWall and CloseMazeWall keep them up to
+///       date after that.
+
+    int stack[MAZE_ROOM_COUNT];
+    int x, z, i, w, room, current, other, top;
+
+    for(i = 0; i < MAZE_WALL_COUNT; i++){
+        treeWall[i] = 0;
+        spareSlot[i] = -1;
+    }
+    spareWallCount = 0;
+
+
+    ///
+    /// Room x,z is number x * WALL_COUNT_Z + z. The z-axis wall numbered
+    ///      x * WALL_COUNT_Z + z is between rooms x,z and x + 1,z, the x-axis
+    ///      wall numbered Z_WALL_COUNT + z * WALL_COUNT_X + x is between
+    ///      rooms x,z and x,z + 1
+    ///
+    for(i = 0; i < Z_WALL_COUNT; i++){
+        wallRoom[i][0] = i;
+        wallRoom[i][1] = i + WALL_COUNT_Z;
+    }
+
+    for(i = Z_WALL_COUNT; i < MAZE_WALL_COUNT; i++){
+        x = (i - Z_WALL_COUNT) % WALL_COUNT_X;
+        z = (i - Z_WALL_COUNT) / WALL_COUNT_X;
+        wallRoom[i][0] = x * WALL_COUNT_Z + z;
+        wallRoom[i][1] = x * WALL_COUNT_Z + z + 1;
+    }
+
+    for(room = 0; room < MAZE_ROOM_COUNT; room++){
+        roomWallCount[room] = 0;
+        roomRegion[room] = -1;
+    }
+
+    for(i = 0; i < MAZE_WALL_COUNT; i++){
+        room = wallRoom[i][0];
+        roomWall[room][roomWallCount[room]++] = i;
+        room = wallRoom[i][1];
+        roomWall[room][roomWallCount[room]++] = i;
+    }
+
+
+    ///
+    /// Label the regions and number their trees
+    ///
+    regionCount = 0;
+    nextRegion = 0;
+    nextRoomNumber = 0;
+    for(room = 0; room < MAZE_ROOM_COUNT; room++){
+        if(roomRegion[room] != -1){
+            continue;
+        }
+
+        roomRegion[room] = nextRegion;
+        stack[0] = room;
+        top = 1;
+        while(top > 0){
+            current = stack[--top];
+            for(i = 0; i < roomWallCount[current]; i++){
+                w = roomWall[current][i];
+                other = (wallRoom[w][0] == current) ? wallRoom[w][1] : wallRoom[w][0];
+
+                if(WallPassable(&mazeWall[w]) && roomRegion[other] == -1){
+                    roomRegion[other] = nextRegion;
+                    treeWall[w] = 1;
+                    stack[top++] = other;
+                }
+            }
+        }
+
+        NumberRegion(room, nextRegion);
+        nextRegion++;
+        regionCount++;
+    }
+
+
+    ///
+    /// Every other open wall is a spare
+    ///
+    for(i = 0; i < MAZE_WALL_COUNT; i++){
+        if(WallPassable(&mazeWall[i]) && !treeWall[i]){
+            AddSpareWall(i);
+        }
+    }
+}
+
+
+
+///
+/// JoinMazeRegions ---------------------------------------
+///
+void JoinMazeRegions(){
+/// Opens walls between regions until the whole maze is one region, taking the
+///       walls in order so no random numbers are used. Called on a newly
+///       generated maze before its walls are placed.
+
+    int i;
+
+    for(i = 0; i < MAZE_WALL_COUNT && regionCount > 1; i++){
+        if(roomRegion[wallRoom[i][0]] != roomRegion[wallRoom[i][1]]){
+            mazeWall[i].state = open;
+            OpenMazeWall(&mazeWall[i]);
+        }
+    }
+}
+
+
+
+///
+/// WallPassable ------------------------------------------
+///
+int WallPassable(Wall *wall){
+/// Returns 1 if the wall is open or opening. A wall which is still moving
+///       counts as the state it is moving to.
+
+    return wall->state == open || wall->state == opening;
+}
+
+
+
+///
+/// NumberRegion ------------------------------------------
+///
+void NumberRegion(int room, int region){
+/// Labels "room" and every room joined to it by tree walls with "region", and
+///       numbers them in the order a depth first search from "room" reaches
+///       them. Each room keeps the tree wall to its parent and the last
+///       number in its subtree, so a room is in the subtree of another when
+///       its number is between their two numbers. The numbers keep counting
+///       up so they never match those left in another region.
+
+    int stack[MAZE_ROOM_COUNT];
+    int next[MAZE_ROOM_COUNT];
+    int top, current, w, other;
+
+    roomRegion[room] = region;
+    roomParentWall[room] = -1;
+    roomFirst[room] = nextRoomNumber++;
+    stack[0] = room;
+    next[0] = 0;
+    top = 1;
+
+    while(top > 0){
+        current = stack[top - 1];
+        if(next[top - 1] == roomWallCount[current]){
+            roomLast[current] = nextRoomNumber - 1;
+            top--;
+            continue;
+        }
+
+        w = roomWall[current][next[top - 1]++];
+        if(!treeWall[w] || w == roomParentWall[current]){
+            continue;
+        }
+
+        other = (wallRoom[w][0] == current) ? wallRoom[w][1] : wallRoom[w][0];
+        roomRegion[other] = region;
+        roomParentWall[other] = w;
+        roomFirst[other] = nextRoomNumber++;
+        stack[top] = other;
+        next[top] = 0;
+        top++;
+    }
+}
+
+
+
+///
+/// InSubtree ---------------------------------------------
+///
+int InSubtree(int room, int root){
+/// Returns 1 if "room" is "root" or below it in the numbered tree.
+
+    return roomFirst[room] >= roomFirst[root] && roomFirst[room] <= roomLast[root];
+}
+
+
+
+///
+/// TreeChild ---------------------------------------------
+///
+int TreeChild(int w){
+/// Returns the room below tree wall "w", the other room is its parent.
+
+    return (roomParentWall[wallRoom[w][0]] == w) ? wallRoom[w][0] : wallRoom[w][1];
+}
+
+
+
+///
+/// AddSpareWall ------------------------------------------
+///
+void AddSpareWall(int w){
+/// Lists "w" as an open wall which is not a tree wall.
+
+    spareSlot[w] = spareWallCount;
+    spareWall[spareWallCount++] = w;
+}
+
+
+
+///
+/// RemoveSpareWall ---------------------------------------
+///
+void RemoveSpareWall(int w){
+/// Takes "w" off the spare walls, the last spare wall is moved into its slot.
+
+    int last;
+
+    last = spareWall[--spareWallCount];
+    spareWall[spareSlot[w]] = last;
+    spareSlot[last] = spareSlot[w];
+    spareSlot[w] = -1;
+}
+
+
+
+///
+/// CrossingWall ------------------------------------------
+///
+int CrossingWall(int child, int extraWall){
+/// Returns a spare wall, or "extraWall", which joins a room in the subtree
+///       below "child" to a room of the same region outside it. Only the
+///       spare walls are looked at, each with one comparison of numbers.
+///       Returns -1 if there is none.
+
+    int i, w;
+
+    for(i = 0; i < spareWallCount; i++){
+        w = spareWall[i];
+        if(InSubtree(wallRoom[w][0], child) != InSubtree(wallRoom[w][1], child)){
+            return w;
+        }
+    }
+
+    w = extraWall;
+    if(w != -1 && roomRegion[wallRoom[w][0]] == roomRegion[wallRoom[w][1]] &&
+       InSubtree(wallRoom[w][0], child) != InSubtree(wallRoom[w][1], child)){
+        return w;
+    }
+
+    return -1;
+}
+
+
+
+///
+/// WouldDisconnect ---------------------------------------
+///
+int WouldDisconnect(Wall *closingWall, Wall *openingWall){
+/// Returns 1 if closing "closingWall" while "openingWall" opens would split
+///       a region of the maze in two. Only closing a tree wall can, and then
+///       only if no spare wall or the opening wall joins the two sides of the
+///       tree.
+
+    int c;
+
+    c = closingWall - mazeWall;
+    if(!treeWall[c]){
+        return 0;
+    }
+
+    return CrossingWall(TreeChild(c), openingWall - mazeWall) == -1;
+}
+
+
+
+///
+/// OpenMazeWall ------------------------------------------
+///
+void OpenMazeWall(Wall *wall){
+/// Updates the regions for "wall" being open or opening. Opening a wall
+///       between two regions joins them and renumbers the joined tree,
+///       otherwise the wall becomes a spare. Nothing changes if it is
+///       already counted as open.
+
+    int w;
+
+    w = wall - mazeWall;
+    if(treeWall[w] || spareSlot[w] != -1){
+        return;
+    }
+
+    if(roomRegion[wallRoom[w][0]] != roomRegion[wallRoom[w][1]]){
+        treeWall[w] = 1;
+        NumberRegion(wallRoom[w][0], roomRegion[wallRoom[w][0]]);
+        regionCount--;
+    }
+    else{
+        AddSpareWall(w);
+    }
+}
+
+
+
+///
+/// CloseMazeWall -----------------------------------------
+///
+void CloseMazeWall(Wall *wall){
+/// Updates the regions for "wall" being closed or closing. Closing a tree wall
+///       needs a spare wall across the two sides of the tree to take its
+///       place, if there is none the region is split. Either way the trees
+///       which changed are renumbered. Nothing changes if it is already
+///       counted as closed.
+
+    int w, r, child, parent;
+
+    w = wall - mazeWall;
+    if(spareSlot[w] != -1){
+        RemoveSpareWall(w);
+        return;
+    }
+    if(!treeWall[w]){
+        return;
+    }
+
+    child = TreeChild(w);
+    parent = (wallRoom[w][0] == child) ? wallRoom[w][1] : wallRoom[w][0];
+    r = CrossingWall(child, -1);
+    treeWall[w] = 0;
+
+    if(r != -1){
+        RemoveSpareWall(r);
+        treeWall[r] = 1;
+        NumberRegion(parent, roomRegion[parent]);
+    }
+    else{
+        NumberRegion(child, nextRegion);
+        NumberRegion(parent, roomRegion[parent]);
+        nextRegion++;
+        regionCount++;
+    }
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 /////
 ///// Utility Functions ========================================================
@@ -1334,16 +1925,71 @@ int PercentChance(float percent){
 ///
 int WalkablePiece(int x, int y, int z){
 /// Given determines if a block is empty or not.
+/// Blocks outside of the world are treated as empty.
 
-    int count = 0, height;
+    if(x < 0 || x >= WORLDX || z < 0 || z >= WORLDZ){
+        return WALKABLE;
+    }
 
-    for(height = 0; height < PLAYER_HEIGHT; height++){
-        if(world[x][y + height][z] != EMPTY_PIECE){
-            count++;
-        }
+    return columnSolid(x, z, y, y + PLAYER_HEIGHT) == 0;
+}
+
+
+
+///
+/// SweepPlayer -------------------------------------------
+///
+void SweepPlayer(float oldPos_x, float oldPos_z, int index_y,
+    float *curPos_x, float *curPos_z){
+/// Moves the player from the old x,z position towards the current one as a
+/// box PLAYER_RADIUS wide on each side, which fills the same heights that
+/// WalkablePiece() checks. The box stops at the first wall in its path
+/// and keeps moving along any axis which is not blocked. Positions are
+/// the negated viewpoint values.
+
+    float box[6], move[3];
+
+    box[0] = -oldPos_x - PLAYER_RADIUS;
+    box[1] = index_y;
+    box[2] = -oldPos_z - PLAYER_RADIUS;
+    box[3] = -oldPos_x + PLAYER_RADIUS;
+    box[4] = index_y + PLAYER_HEIGHT;
+    box[5] = -oldPos_z + PLAYER_RADIUS;
+
+    move[0] = oldPos_x - *curPos_x;
+    move[1] = 0.0;
+    move[2] = oldPos_z - *curPos_z;
+
+    sweepBox(box, move);
+
+    *curPos_x = -(box[0] + PLAYER_RADIUS);
+    *curPos_z = -(box[2] + PLAYER_RADIUS);
+}
+
+
+
+///
+/// FloorLevel --------------------------------------------
+///
+int FloorLevel(int x, int y, int z){
+/// Finds the highest height at or below y, down to 1, where the piece is
+/// not walkable, or 0 if there is none. The column heights answer
+/// this without stepping down one block at a time.
+
+    int highest;
+
+    if(y <= 0){
+        return y;
     }
 
-    return count == 0;
+    highest = columnFloor(x, z, y + PLAYER_HEIGHT - 1);
+    if(highest > y){
+        return y;
+    }
+    if(highest > 0){
+        return highest;
+    }
+    return 0;
 }
 
 
@@ -1374,7 +2020,7 @@ float DeltaGravity(int lastCollisionTime){
 ///       time has passed, and then figure out how far gravity pulled an object
 ///       down, in the amount of time that has passed.
 
-    int currentTime = glutGet(GLUT_ELAPSED_TIME);
+    int currentTime = getElapsedTime();
     int deltaTime = currentTime - lastCollisionTime;
     return GRAVITY_RATE * deltaTime / 1000;
 }
@@ -1399,7 +2045,7 @@ void PrintWallGeneration(){
             putchar(' ');
 
 
-            if(pillars[x][z].wall[north]->state == closed){
+            if(PillarWall(x, z, north)->state == closed){
                 putchar('|');
             }
             else{
@@ -1410,14 +2056,14 @@ void PrintWallGeneration(){
         putchar('\n');
 
         for(x = 0; x < WALL_COUNT_X - 1; x++){
-            if(pillars[x][z].wall[west]->state == closed){
+            if(PillarWall(x, z, west)->state == closed){
                 putchar('-');
             }
             else{
                 putchar(' ');
             }
             putchar('+');
-            if(pillars[x][z].wall[east]->state == closed){
+            if(PillarWall(x, z, east)->state == closed){
                 putchar('-');
             }
             else{
@@ -1428,7 +2074,7 @@ void PrintWallGeneration(){
 
         for(x = 0; x < WALL_COUNT_X - 1; x++){
             putchar(' ');
-            if(pillars[x][z].wall[south]->state == closed){
+            if(PillarWall(x, z, south)->state == closed){
                 putchar('|');
             }
             else{
@@ -1453,33 +2099,35 @@ void PrintWallMovement(){
 
 
     if(openingWall == south){
-        printf("\tOpening wall: %d (south), %d\n", openingWall, pillars[movingPillar_x][movingPillar_z].wall[openingWall]->state == opening );
+        printf("\tOpening wall: %d (south), %d\n", openingWall, PillarWall(movingPillar_x, movingPillar_z, openingWall)->state == opening );
     }
     else if(openingWall == north){
-        printf("\tOpening wall: %d (north), %d\n", openingWall, pillars[movingPillar_x][movingPillar_z].wall[openingWall]->state == opening );
+        printf("\tOpening wall: %d (north), %d\n", openingWall, PillarWall(movingPillar_x, movingPillar_z, openingWall)->state == opening );
     }
     else if(openingWall == east){
-        printf("\tOpening wall: %d (east), %d\n", openingWall, pillars[movingPillar_x][movingPillar_z].wall[openingWall]->state == opening );
+        printf("\tOpening wall: %d (east), %d\n", openingWall, PillarWall(movingPillar_x, movingPillar_z, openingWall)->state == opening );
     }
     else if(openingWall == west){
-        printf("\tOpening wall: %d (west), %d\n", openingWall, pillars[movingPillar_x][movingPillar_z].wall[openingWall]->state == opening );
+        printf("\tOpening wall: %d (west), %d\n", openingWall, PillarWall(movingPillar_x, movingPillar_z, openingWall)->state == opening );
     }
 
 
 
     if(closingWall == south){
-        printf("\tClosing wall: %d (south), %d\n", closingWall, pillars[movingPillar_x][movingPillar_z].wall[closingWall]->state == closing );
+        printf("\tClosing wall: %d (south), %d\n", closingWall, PillarWall(movingPillar_x, movingPillar_z, closingWall)->state == closing );
     }
     else if(closingWall == north){
-        printf("\tClosing wall: %d (north), %d\n", closingWall, pillars[movingPillar_x][movingPillar_z].wall[closingWall]->state == closing );
+        printf("\tClosing wall: %d (north), %d\n", closingWall, PillarWall(movingPillar_x, movingPillar_z, closingWall)->state == closing );
     }
     else if(closingWall == east){
-        printf("\tClosing wall: %d (east), %d\n", closingWall, pillars[movingPillar_x][movingPillar_z].wall[closingWall]->state == closing );
+        printf("\tClosing wall: %d (east), %d\n", closingWall, PillarWall(movingPillar_x, movingPillar_z, closingWall)->state == closing );
     }
     else if(closingWall == west){
-        printf("\tClosing wall: %d (west), %d\n", closingWall, pillars[movingPillar_x][movingPillar_z].wall[closingWall]->state == closing );
+        printf("\tClosing wall: %d (west), %d\n", closingWall, PillarWall(movingPillar_x, movingPillar_z, closingWall)->state == closing );
     }
 
+    printf("\tMaze regions: %d, moves vetoed so far: %d\n", regionCount, vetoedMoves);
+
     //printf("\tWall percent: %f\n", wallPercent);
     printf("\n");
 
@@ -1491,28 +2139,18 @@ void PrintWallMovement(){
 ///
 /// Pillar_WallCount --------------------------------------
 ///
-int Pillar_WallCount(Pillar *pillar){
+int Pillar_WallCount(int x, int z){
 /// Counts the number of walls on a given pillar that are closed.
 
     int count = 0;
+    int i;
 
-    if(pillar->wall[north] != NULL && pillar->wall[north]->state == closed){
-        count++;
-    }
-
-    if(pillar->wall[east] != NULL && pillar->wall[east]->state == closed){
-        count++;
-    }
-
-    if(pillar->wall[south] != NULL && pillar->wall[south]->state == closed){
-        count++;
-    }
-
-    if(pillar->wall[west] != NULL && pillar->wall[west]->state == closed){
-        count++;
+    for(i = 0; i < 4; i++){
+        if(PillarWall(x, z, i)->state == closed){
+            count++;
+        }
     }
 
-
     return count;
 }
 
@@ -1522,33 +2160,16 @@ int Pillar_WallCount(Pillar *pillar){
 /// CountAllWalls -----------------------------------------
 ///
 int CountAllWalls(){
-/// Goes through each pillar, and counts how many closed walls there are currently
-///      closed, or are currently closing on the map.
+/// Goes through every wall, and counts how many walls are currently closed,
+///      or are currently closing on the map.
 
-    Pillar *currentPillar;
-    int count, x, z;
+    int count, i;
 
     count = 0;
 
-    for(x = 0; x < WALL_COUNT_X - 1; x++){
-        for(z = 0; z < WALL_COUNT_Z - 1; z++){
-            currentPillar = &(pillars[x][z]);
-
-            if(x == 0 && (currentPillar->wall[west]->state == closed || currentPillar->wall[west]->state == closing)){
-                count++;
-            }
-
-            if(z == 0 &&  (currentPillar->wall[north]->state == closed || currentPillar->wall[north]->state == closing)){
-                count++;
-            }
-
-            if( (currentPillar->wall[east]->state == closed || currentPillar->wall[east]->state == closing)){
-                count++;
-            }
-
-            if( (currentPillar->wall[south]->state == closed || currentPillar->wall[south]->state == closing)){
-                count++;
-            }
+    for(i = 0; i < MAZE_WALL_COUNT; i++){
+        if(mazeWall[i].state == closed || mazeWall[i].state == closing){
+            count++;
         }
     }
 
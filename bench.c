@@ -0,0 +1,770 @@
+/* Headless benchmark, runs the simulation and culling code without */
+/* a window so CPU side timings can be measured on machines with no GPU */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "graphics.h"
+
+	/* simulated milliseconds which pass each benchmark frame */
+#define BENCH_FRAME_MS 16
+	/* distance moved each frame, the same as one key press */
+#define BENCH_STEP 0.3
+	/* number of full turns the viewpoint makes during the benchmark */
+#define BENCH_TURNS 2
+
+	/* ticks run by the collision benchmark, the size of each body and */
+	/* the fastest it moves across in one tick and the gravity added */
+	/* to its speed each tick, in cubes */
+#define COLLIDE_TICKS 100
+#define COLLIDE_WIDTH 0.6
+#define COLLIDE_HEIGHT 1.8
+#define COLLIDE_SPEED 4.0
+#define COLLIDE_GRAVITY 0.05
+
+	/* ticks run by the mob benchmark and the fastest a mob walks in */
+	/* cubes a tick */
+#define MOB_TICKS 200
+#define MOB_SPEED 0.2
+
+	/* ticks run by the flow field benchmark, ten seconds of walls */
+	/* changing at 60 ticks a second */
+#define FLOW_TICKS 600
+
+#define STAGE_UPDATE 0
+#define STAGE_COLLISION 1
+#define STAGE_CULL 2
+#define STAGE_COUNT 3
+
+	/* hardware cache counters read around each stage when the kernel */
+	/* allows it, L1D reads and misses and last level cache references */
+	/* and misses */
+#define CACHE_L1_READS 0
+#define CACHE_L1_MISSES 1
+#define CACHE_LL_REFS 2
+#define CACHE_LL_MISSES 3
+#define CACHE_EVENTS 4
+
+extern void update();
+extern void collisionResponse();
+extern void buildDisplayList();
+
+extern void setViewPosition(float, float, float);
+extern void getViewPosition(float *, float *, float *);
+extern void setOldViewPosition(float, float, float);
+extern void setViewOrientation(float, float, float);
+extern void getViewOrientation(float *, float *, float *);
+
+extern void BuildViewMatrices(float *, float *);
+extern void ExtractFrustumFromMatrices(float *, float *);
+extern int CubeInFrustum(float, float, float, float);
+extern int CubeInFrustum2(float, float, float, float);
+extern unsigned int CubeBatchInFrustum(float *, float *, float *, float);
+
+	/* flag used to indicate that the test world should be used */
+extern int testWorld;
+	/* number of frames to run and the simulated clock */
+extern int benchFrames;
+extern int benchTime;
+	/* count of cubes in the display list after culling */
+extern int displayCount;
+	/* count of chunks and quads drawn when chunk geometry is used */
+extern int meshCubes;
+extern int meshChunkCount;
+extern int meshQuadCount;
+	/* number of chunks changed in the last frame */
+extern int dirtyChunkCount;
+	/* octree nodes visited and skipped by the last culling pass */
+extern int octreeVisited;
+extern int octreeEmpty;
+extern int octreeHidden;
+extern int octreeLevel;
+extern int octreeCount;
+	/* nodes, cubes and chunks rejected by occlusion culling */
+extern int occlusion;
+extern int occludedNodes;
+extern int occludedCubes;
+extern int meshOccludedCount;
+extern int occluderCount;
+	/* number of cubes tested by the frustum micro-benchmark, 0 if */
+	/* the frame benchmark is run instead */
+extern int frustumBench;
+	/* number of random reads made by the world storage benchmark, 0 */
+	/* if it is not run */
+extern int worldBench;
+
+	/* recording given with -replay, NULL if the benchmark is run */
+extern char *replayFile;
+extern void runReplay();
+
+	/* number of bodies moved by the collision benchmark, 0 if it is */
+	/* not run */
+extern int collideBench;
+extern int sweepBox(float [6], float [3]);
+extern int columnSolid(int, int, int, int);
+extern int columnFloor(int, int, int);
+
+	/* number of mobs stepped by the mob benchmark, 0 if it is not run */
+extern int mobBench;
+extern int jobThreads;
+extern int mobDrawCount;
+extern float *mobX, *mobY, *mobZ;
+extern long mobNeighbourTests;
+extern void createMob(int, float, float, float, float);
+extern void setMobSpeed(int, float, float, float);
+extern void saveMobPositions();
+extern void hashMobs();
+extern void stepMobs();
+extern void cullMobs();
+
+	/* number of mobs walked through the maze by the flow field */
+	/* benchmark, 0 if it is not run */
+extern int flowBench;
+extern int flowWidth, flowDepth, flowBX, flowBZ, flowY;
+extern int flowSearches, flowRepairs;
+extern long flowSearchCells, flowRepairCells;
+extern int flowStandable(int, int);
+extern void updateFlowField();
+extern int flowDistance(float, float);
+extern int checkFlowField();
+extern void seekMob(int);
+extern void flushWorldDirty();
+extern int tickRate;
+
+	/* chunked world storage from world.c */
+extern GLubyte getWorldCube(int, int, int);
+extern void unpackWorldChunk(WorldChunk *, GLubyte *);
+extern long worldMemory(int [9]);
+extern int worldChunkCount;
+	/* chunks in memory and load times when the world is streamed */
+extern void printStreamStats();
+extern void checkChunks();
+
+char *stageName[STAGE_COUNT] = {"update", "collision", "cull"};
+
+	/* file descriptors of the cache counters, -1 if not available */
+int cacheCounter[CACHE_EVENTS] = {-1, -1, -1, -1};
+
+	/* returns a monotonic wall clock time in milliseconds */
+double benchClock() {
+struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return(ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0);
+}
+
+	/* open the cache counters for the calling thread, counters which */
+	/* the kernel or hardware does not support are left at -1 */
+void openCacheCounters() {
+#ifdef __linux__
+struct perf_event_attr attr;
+int i;
+
+   for(i=0; i<CACHE_EVENTS; i++) {
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      if (i < CACHE_LL_REFS) {
+         attr.type = PERF_TYPE_HW_CACHE;
+         attr.config = PERF_COUNT_HW_CACHE_L1D |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (((i == CACHE_L1_READS) ? PERF_COUNT_HW_CACHE_RESULT_ACCESS :
+            PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+      } else {
+         attr.type = PERF_TYPE_HARDWARE;
+         attr.config = (i == CACHE_LL_REFS) ? PERF_COUNT_HW_CACHE_REFERENCES :
+            PERF_COUNT_HW_CACHE_MISSES;
+      }
+      cacheCounter[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+   }
+#endif
+}
+
+	/* read the cache counters into count[], -1 for a missing counter */
+void readCacheCounters(long long count[CACHE_EVENTS]) {
+int i;
+
+   for(i=0; i<CACHE_EVENTS; i++) {
+      count[i] = -1;
+#ifdef __linux__
+      if ((cacheCounter[i] != -1) &&
+          (read(cacheCounter[i], &count[i], sizeof(long long)) !=
+           sizeof(long long)))
+         count[i] = -1;
+#endif
+   }
+}
+
+	/* print the miss rate of hits out of total as a percentage */
+void printMissRate(long long misses, long long total) {
+   if ((misses < 0) || (total <= 0))
+      printf(" %10s", "n/a");
+   else
+      printf(" %9.2f%%", 100.0 * misses / total);
+}
+
+	/* move the viewpoint along the scripted camera path, the */
+	/* viewpoint turns in place while walking forward like the w key */
+void benchCamera(int frame) {
+float x, y, z;
+float mx, my, mz;
+float roty;
+
+   getViewOrientation(&mx, &my, &mz);
+   my = 130.0 + (360.0 * BENCH_TURNS * frame) / benchFrames;
+   setViewOrientation(mx, my, mz);
+
+   getViewPosition(&x, &y, &z);
+   setOldViewPosition(x, y, z);
+   roty = my / 180.0 * M_PI;
+   x -= sinf(roty) * BENCH_STEP;
+   z += cosf(roty) * BENCH_STEP;
+   setViewPosition(x, y, z);
+}
+
+	/* time the single cube frustum tests against the batched test */
+	/* for frustumBench random cubes around the starting viewpoint */
+void runFrustumBenchmark() {
+float proj[16], modl[16];
+float *x, *y, *z;
+double start, elapsed[3];
+unsigned int inside;
+int n, b, count[3], differ;
+
+   x = malloc(sizeof(float) * (frustumBench + FRUSTUM_BATCH));
+   y = malloc(sizeof(float) * (frustumBench + FRUSTUM_BATCH));
+   z = malloc(sizeof(float) * (frustumBench + FRUSTUM_BATCH));
+   if ((x == NULL) || (y == NULL) || (z == NULL)) {
+      printf("ERROR: unable to allocate memory for the frustum benchmark\n");
+      exit(1);
+   }
+	/* the tail is padded so the last batch is always full */
+   for(n=0; n<frustumBench + FRUSTUM_BATCH; n++) {
+      x[n] = (rand() % WORLDX) + 0.5;
+      y[n] = (rand() % WORLDY) + 0.5;
+      z[n] = (rand() % WORLDZ) + 0.5;
+   }
+
+   BuildViewMatrices(proj, modl);
+   ExtractFrustumFromMatrices(proj, modl);
+
+   count[0] = count[1] = count[2] = 0;
+   start = benchClock();
+   for(n=0; n<frustumBench; n++)
+      if (CubeInFrustum(x[n], y[n], z[n], 0.5) != 0)
+         count[0]++;
+   elapsed[0] = benchClock() - start;
+
+   start = benchClock();
+   for(n=0; n<frustumBench; n++)
+      if (CubeInFrustum2(x[n], y[n], z[n], 0.5) != 0)
+         count[1]++;
+   elapsed[1] = benchClock() - start;
+
+   start = benchClock();
+   for(n=0; n<frustumBench; n+=FRUSTUM_BATCH) {
+      inside = CubeBatchInFrustum(&x[n], &y[n], &z[n], 0.5);
+      for(b=0; (b<FRUSTUM_BATCH) && (n+b<frustumBench); b++)
+         if (inside & (1 << b))
+            count[2]++;
+   }
+   elapsed[2] = benchClock() - start;
+
+	/* check the batched test agrees with CubeInFrustum() */
+   differ = 0;
+   for(n=0; n<frustumBench; n+=FRUSTUM_BATCH) {
+      inside = CubeBatchInFrustum(&x[n], &y[n], &z[n], 0.5);
+      for(b=0; (b<FRUSTUM_BATCH) && (n+b<frustumBench); b++)
+         if (((inside >> b) & 1) !=
+             (CubeInFrustum(x[n+b], y[n+b], z[n+b], 0.5) != 0))
+            differ++;
+   }
+
+   printf("\nFrustum benchmark: %d cubes, batches of %d\n", frustumBench,
+      FRUSTUM_BATCH);
+   printf("%-20s %10s %10s %10s\n", "test", "total ms", "ns/cube", "inside");
+   printf("%-20s %10.2f %10.2f %10d\n", "CubeInFrustum", elapsed[0],
+      elapsed[0] * 1000000.0 / frustumBench, count[0]);
+   printf("%-20s %10.2f %10.2f %10d\n", "CubeInFrustum2", elapsed[1],
+      elapsed[1] * 1000000.0 / frustumBench, count[1]);
+   printf("%-20s %10.2f %10.2f %10d\n", "CubeBatchInFrustum", elapsed[2],
+      elapsed[2] * 1000000.0 / frustumBench, count[2]);
+   printf("batched results differing from CubeInFrustum: %d\n", differ);
+
+   free(x);
+   free(y);
+   free(z);
+}
+
+	/* returns 1 if the box overlaps a cube which is not empty */
+int boxInCubes(float box[6]) {
+int x, y, z;
+
+   for(x=(int) floorf(box[0]); x<(int) ceilf(box[3]); x++)
+      for(y=(int) floorf(box[1]); y<(int) ceilf(box[4]); y++)
+         for(z=(int) floorf(box[2]); z<(int) ceilf(box[5]); z++)
+            if (getWorldCube(x, y, z) != 0)
+               return(1);
+   return(0);
+}
+
+	/* move collideBench boxes through the world for COLLIDE_TICKS ticks */
+	/* with sweepBox(), each falls and bounces off walls at up to */
+	/* COLLIDE_SPEED cubes a tick which is faster than a wall is thick, */
+	/* prints the sweeps per second and checks no box ended up in a cube */
+void runCollisionBenchmark() {
+float (*box)[6], (*speed)[3];
+double start, elapsed;
+long hits;
+int n, t, hit, tries, inside, x, z;
+
+   box = malloc(sizeof(float) * 6 * collideBench);
+   speed = malloc(sizeof(float) * 3 * collideBench);
+   if ((box == NULL) || (speed == NULL)) {
+      printf("ERROR: unable to allocate memory for the collision benchmark\n");
+      exit(1);
+   }
+	/* bodies are placed where they do not overlap a cube */
+   for(n=0; n<collideBench; n++) {
+      tries = 0;
+      do {
+         box[n][0] = (rand() % (WORLDX * 100)) / 100.0;
+         box[n][1] = (rand() % ((WORLDY - 2) * 100)) / 100.0;
+         box[n][2] = (rand() % (WORLDZ * 100)) / 100.0;
+         box[n][3] = box[n][0] + COLLIDE_WIDTH;
+         box[n][4] = box[n][1] + COLLIDE_HEIGHT;
+         box[n][5] = box[n][2] + COLLIDE_WIDTH;
+      } while ((boxInCubes(box[n]) == 1) && (++tries < 100));
+      speed[n][0] = COLLIDE_SPEED * ((rand() % 2001) - 1000) / 1000.0;
+      speed[n][1] = 0.0;
+      speed[n][2] = COLLIDE_SPEED * ((rand() % 2001) - 1000) / 1000.0;
+   }
+	/* build the column runs before timing */
+   for(x=0; x<WORLDX; x+=CHUNK_SIZE)
+      for(z=0; z<WORLDZ; z+=CHUNK_SIZE)
+         columnSolid(x, z, 0, 1);
+
+   hits = 0;
+   start = benchClock();
+   for(t=0; t<COLLIDE_TICKS; t++)
+      for(n=0; n<collideBench; n++) {
+         speed[n][1] -= COLLIDE_GRAVITY;
+         hit = sweepBox(box[n], speed[n]);
+         if (hit & 1)
+            speed[n][0] = -speed[n][0];
+         if (hit & 2)
+            speed[n][1] = 0.0;
+         if (hit & 4)
+            speed[n][2] = -speed[n][2];
+         if (hit != 0)
+            hits++;
+      }
+   elapsed = benchClock() - start;
+
+   inside = 0;
+   for(n=0; n<collideBench; n++)
+      inside += boxInCubes(box[n]);
+
+   printf("\nCollision benchmark: %d bodies, %d ticks, %s\n", collideBench,
+      COLLIDE_TICKS, (testWorld == 1) ? "test world" : "maze world");
+   printf("total ms %.2f  sweeps/sec %.0f  ns/sweep %.1f\n", elapsed,
+      (double) collideBench * COLLIDE_TICKS * 1000.0 / elapsed,
+      elapsed * 1000000.0 / ((double) collideBench * COLLIDE_TICKS));
+   printf("sweeps stopped by a cube: %ld  bodies inside cubes at the end: %d\n",
+      hits, inside);
+   free(box);
+   free(speed);
+}
+
+	/* create mobBench mobs standing on the ground and walking in random */
+	/* directions and run MOB_TICKS ticks of hashing, stepping and */
+	/* frustum culling them while the viewpoint turns, prints the time */
+	/* of each stage and checks no mob ended up in a cube */
+void runMobBenchmark() {
+double total[3], max[3], t[4];
+long drawn, neighbours;
+float proj[16], modl[16], box[6];
+int n, x, y, z, tick, s, inside;
+char *name[3] = {"hash", "step", "cull"};
+
+   for(n=0; n<mobBench; n++) {
+      x = rand() % WORLDX;
+      z = rand() % WORLDZ;
+      y = columnFloor(x, z, WORLDY - 1) + 1;
+      createMob(n, x, y, z, 0.0);
+      setMobSpeed(n, MOB_SPEED * ((rand() % 2001) - 1000) / 1000.0, 0.0,
+         MOB_SPEED * ((rand() % 2001) - 1000) / 1000.0);
+   }
+   for(s=0; s<3; s++)
+      total[s] = max[s] = 0.0;
+   drawn = neighbours = 0;
+
+   for(tick=0; tick<MOB_TICKS; tick++) {
+	/* the viewpoint looks down at the ground as it turns */
+      setViewOrientation(45.0, tick * 360.0 / MOB_TICKS, 0.0);
+      BuildViewMatrices(proj, modl);
+      ExtractFrustumFromMatrices(proj, modl);
+      saveMobPositions();
+      t[0] = benchClock();
+      hashMobs();
+      t[1] = benchClock();
+      stepMobs();
+      t[2] = benchClock();
+      cullMobs();
+      t[3] = benchClock();
+      for(s=0; s<3; s++) {
+         total[s] += t[s + 1] - t[s];
+         if (t[s + 1] - t[s] > max[s])
+            max[s] = t[s + 1] - t[s];
+      }
+      drawn += mobDrawCount;
+      neighbours += mobNeighbourTests;
+   }
+
+	/* the same box stepMobs() moves */
+   inside = 0;
+   for(n=0; n<mobBench; n++) {
+      box[0] = mobX[n] + 0.1;
+      box[1] = mobY[n];
+      box[2] = mobZ[n] + 0.1;
+      box[3] = box[0] + 0.8;
+      box[4] = box[1] + 1.0;
+      box[5] = box[2] + 0.8;
+      inside += boxInCubes(box);
+   }
+
+   printf("\nMob benchmark: %d mobs, %d ticks, %d threads, %s\n", mobBench,
+      MOB_TICKS, jobThreads, (testWorld == 1) ? "test world" : "maze world");
+   printf("%-12s %10s %10s %12s\n", "stage", "avg ms", "max ms", "total ms");
+   for(s=0; s<3; s++)
+      printf("%-12s %10.4f %10.4f %12.2f\n", name[s], total[s] / MOB_TICKS,
+         max[s], total[s]);
+   printf("ns per mob per tick: %.1f\n",
+      (total[0] + total[1] + total[2]) * 1000000.0 / ((double) mobBench * MOB_TICKS));
+   printf("mobs in frustum per tick: %ld  neighbours per mob per tick: %.2f\n",
+      drawn / MOB_TICKS, (double) neighbours / ((double) mobBench * MOB_TICKS));
+   printf("mobs inside cubes at the end: %d\n", inside);
+}
+
+	/* add up the steps to the target of the mobs which have a way */
+	/* there, returns how many do and counts those within near steps */
+int flowMobSteps(long *steps, int near, int *arrived) {
+int n, d, count;
+
+   count = 0;
+   *steps = 0;
+   *arrived = 0;
+   for(n=0; n<flowBench; n++) {
+      d = flowDistance(mobX[n] + 0.5, mobZ[n] + 0.5);
+      if (d < 0)
+         continue;
+      count++;
+      *steps += d;
+      if (d <= near)
+         (*arrived)++;
+   }
+   return(count);
+}
+
+	/* stand flowBench mobs on random open cells of the maze, make them */
+	/* seek the player and run FLOW_TICKS ticks of update(), which */
+	/* changes the walls, the flow field and the mobs, prints the time */
+	/* of each and the work done by the field, then checks the repaired */
+	/* field against a full search */
+void runFlowBenchmark() {
+double total[3], max[3], t[4];
+long startSteps, endSteps;
+int n, x, z, tick, s, startCount, endCount, arrived, differ;
+char *name[3] = {"update", "flow", "mobs"};
+
+   if (flowWidth == 0) {
+      printf("ERROR: -flowbench needs the maze world\n");
+      exit(1);
+   }
+   for(n=0; n<flowBench; n++) {
+      do {
+         x = flowBX + rand() % flowWidth;
+         z = flowBZ + rand() % flowDepth;
+      } while (flowStandable(x, z) == 0);
+      createMob(n, x, flowY, z, 0.0);
+      seekMob(n);
+   }
+   for(s=0; s<3; s++)
+      total[s] = max[s] = 0.0;
+   startCount = 0;
+   startSteps = 0;
+
+   for(tick=0; tick<FLOW_TICKS; tick++) {
+      benchTime += 1000 / tickRate;
+      saveMobPositions();
+      t[0] = benchClock();
+      update();
+      flushWorldDirty();
+      t[1] = benchClock();
+      updateFlowField();
+      t[2] = benchClock();
+      hashMobs();
+      stepMobs();
+      t[3] = benchClock();
+      for(s=0; s<3; s++) {
+         total[s] += t[s + 1] - t[s];
+         if (t[s + 1] - t[s] > max[s])
+            max[s] = t[s + 1] - t[s];
+      }
+      if (tick == 0)
+         startCount = flowMobSteps(&startSteps, 2, &arrived);
+   }
+   endCount = flowMobSteps(&endSteps, 2, &arrived);
+   differ = checkFlowField();
+
+   printf("\nFlow field benchmark: %d mobs, %d ticks, %dx%d cells\n",
+      flowBench, FLOW_TICKS, flowWidth, flowDepth);
+   printf("%-12s %10s %10s %12s\n", "stage", "avg ms", "max ms", "total ms");
+   for(s=0; s<3; s++)
+      printf("%-12s %10.4f %10.4f %12.2f\n", name[s], total[s] / FLOW_TICKS,
+         max[s], total[s]);
+	/* the check above is one more full search */
+   printf("full searches: %d  cells per search: %ld\n", flowSearches - 1,
+      (flowSearches > 1) ? (flowSearchCells / flowSearches) : 0);
+   printf("repairs: %d  cells changed per repair: %.1f\n", flowRepairs,
+      (flowRepairs > 0) ? (double) flowRepairCells / flowRepairs : 0.0);
+   printf("mobs with a way to the player: %d at the start averaging %.1f steps, %d at the end averaging %.1f steps\n",
+      startCount, (startCount > 0) ? (double) startSteps / startCount : 0.0,
+      endCount, (endCount > 0) ? (double) endSteps / endCount : 0.0);
+   printf("mobs within 2 steps of the player at the end: %d\n", arrived);
+   printf("cells differing from a full search at the end: %d\n", differ);
+}
+
+	/* compare the memory used by the chunked world with a plain array */
+	/* of one byte per cube and time reading every cube in order, */
+	/* unpacking every chunk and worldBench random reads from each */
+void runWorldBenchmark() {
+GLubyte *raw, cell[CHUNK_CUBES];
+short *x, *y, *z;
+double start, elapsed[5];
+long sum[5], size, memory;
+int bits[9];
+int i, j, k, n;
+
+   size = (long) WORLDX * WORLDY * WORLDZ;
+   raw = malloc(size);
+   x = malloc(sizeof(short) * worldBench);
+   y = malloc(sizeof(short) * worldBench);
+   z = malloc(sizeof(short) * worldBench);
+   if ((raw == NULL) || (x == NULL) || (y == NULL) || (z == NULL)) {
+      printf("ERROR: unable to allocate memory for the world benchmark\n");
+      exit(1);
+   }
+   for(i=0; i<WORLDX; i++)
+      for(j=0; j<WORLDY; j++)
+         for(k=0; k<WORLDZ; k++)
+            raw[((long) i * WORLDY + j) * WORLDZ + k] = getWorldCube(i, j, k);
+   for(n=0; n<worldBench; n++) {
+      x[n] = rand() % WORLDX;
+      y[n] = rand() % WORLDY;
+      z[n] = rand() % WORLDZ;
+   }
+   memory = worldMemory(bits);
+
+	/* every cube in x, y, z order */
+   start = benchClock();
+   sum[0] = 0;
+   for(i=0; i<WORLDX; i++)
+      for(j=0; j<WORLDY; j++)
+         for(k=0; k<WORLDZ; k++)
+            sum[0] += raw[((long) i * WORLDY + j) * WORLDZ + k];
+   elapsed[0] = benchClock() - start;
+
+   start = benchClock();
+   sum[1] = 0;
+   for(i=0; i<WORLDX; i++)
+      for(j=0; j<WORLDY; j++)
+         for(k=0; k<WORLDZ; k++)
+            sum[1] += getWorldCube(i, j, k);
+   elapsed[1] = benchClock() - start;
+
+	/* every allocated chunk unpacked at once, the empty chunks */
+	/* add nothing to the sum and the time is per allocated cube */
+   start = benchClock();
+   sum[2] = 0;
+   for(n=0; n<CHUNKX * CHUNKY * CHUNKZ; n++)
+      if (worldChunk[n] != NULL) {
+         unpackWorldChunk(worldChunk[n], cell);
+         for(i=0; i<CHUNK_CUBES; i++)
+            sum[2] += cell[i];
+      }
+   elapsed[2] = benchClock() - start;
+
+	/* random cubes */
+   start = benchClock();
+   sum[3] = 0;
+   for(n=0; n<worldBench; n++)
+      sum[3] += raw[((long) x[n] * WORLDY + y[n]) * WORLDZ + z[n]];
+   elapsed[3] = benchClock() - start;
+
+   start = benchClock();
+   sum[4] = 0;
+   for(n=0; n<worldBench; n++)
+      sum[4] += getWorldCube(x[n], y[n], z[n]);
+   elapsed[4] = benchClock() - start;
+
+   printf("\nWorld benchmark: %dx%dx%d world, %d random reads\n", WORLDX,
+      WORLDY, WORLDZ, worldBench);
+   printf("plain array: %ld bytes\n", size);
+   printf("chunks:      %ld bytes, %d of %d chunks allocated\n", memory,
+      worldChunkCount, CHUNKX * CHUNKY * CHUNKZ);
+   printf("chunks by bits per cube: 0: %d  1: %d  2: %d  4: %d  8: %d\n",
+      bits[0], bits[1], bits[2], bits[4], bits[8]);
+   printf("%-20s %10s %10s %12s\n", "read", "total ms", "ns/cube", "sum");
+   printf("%-20s %10.2f %10.2f %12ld\n", "array in order", elapsed[0],
+      elapsed[0] * 1000000.0 / size, sum[0]);
+   printf("%-20s %10.2f %10.2f %12ld\n", "chunks in order", elapsed[1],
+      elapsed[1] * 1000000.0 / size, sum[1]);
+   printf("%-20s %10.2f %10.2f %12ld\n", "chunks unpacked", elapsed[2],
+      elapsed[2] * 1000000.0 / ((worldChunkCount > 0) ?
+      (double) worldChunkCount * CHUNK_CUBES : 1.0), sum[2]);
+   printf("%-20s %10.2f %10.2f %12ld\n", "array random", elapsed[3],
+      elapsed[3] * 1000000.0 / worldBench, sum[3]);
+   printf("%-20s %10.2f %10.2f %12ld\n", "chunks random", elapsed[4],
+      elapsed[4] * 1000000.0 / worldBench, sum[4]);
+
+   free(raw);
+   free(x);
+   free(y);
+   free(z);
+}
+
+	/* run benchFrames frames of update, collision and culling and */
+	/* print the time spent in each stage */
+void runBenchmark() {
+double total[STAGE_COUNT], min[STAGE_COUNT], max[STAGE_COUNT];
+double start, elapsed;
+long cubes = 0, chunks = 0, quads = 0, dirty = 0;
+long visited = 0, empty = 0, hidden = 0;
+long occNodes = 0, occCubes = 0, occChunks = 0, occluders = 0;
+long long cache[STAGE_COUNT][CACHE_EVENTS], before[CACHE_EVENTS];
+long long after[CACHE_EVENTS];
+int frame, s, i;
+
+   if (replayFile != NULL) {
+      runReplay();
+      return;
+   }
+   if (frustumBench > 0) {
+      runFrustumBenchmark();
+      return;
+   }
+   if (worldBench > 0) {
+      runWorldBenchmark();
+      return;
+   }
+   if (collideBench > 0) {
+      runCollisionBenchmark();
+      return;
+   }
+   if (mobBench > 0) {
+      runMobBenchmark();
+      return;
+   }
+   if (flowBench > 0) {
+      runFlowBenchmark();
+      return;
+   }
+
+   for(s=0; s<STAGE_COUNT; s++) {
+      total[s] = 0.0;
+      min[s] = 1.0e9;
+      max[s] = 0.0;
+      for(i=0; i<CACHE_EVENTS; i++)
+         cache[s][i] = 0;
+   }
+   openCacheCounters();
+
+   for(frame=0; frame<benchFrames; frame++) {
+      benchTime += BENCH_FRAME_MS;
+      for(s=0; s<STAGE_COUNT; s++) {
+		/* the counters are read outside of the timed part */
+         readCacheCounters(before);
+         start = benchClock();
+         if (s == STAGE_UPDATE)
+            update();
+         else if (s == STAGE_COLLISION) {
+            benchCamera(frame);
+            collisionResponse();
+         } else
+            buildDisplayList();
+         elapsed = benchClock() - start;
+         readCacheCounters(after);
+         for(i=0; i<CACHE_EVENTS; i++)
+            if ((before[i] < 0) || (after[i] < 0) || (cache[s][i] < 0))
+               cache[s][i] = -1;
+            else
+               cache[s][i] += after[i] - before[i];
+
+         total[s] += elapsed;
+         if (elapsed < min[s]) min[s] = elapsed;
+         if (elapsed > max[s]) max[s] = elapsed;
+      }
+      cubes += displayCount;
+      chunks += meshChunkCount;
+      quads += meshQuadCount;
+      dirty += dirtyChunkCount;
+      visited += octreeVisited;
+      empty += octreeEmpty;
+      hidden += octreeHidden;
+      occNodes += occludedNodes;
+      occCubes += occludedCubes;
+      occChunks += meshOccludedCount;
+      occluders += occluderCount;
+   }
+
+#ifdef MORTON_LAYOUT
+   printf("\nBenchmark: %d frames, %s, morton layout\n", benchFrames,
+      (testWorld == 1) ? "test world" : "maze world");
+#else
+   printf("\nBenchmark: %d frames, %s, row layout\n", benchFrames,
+      (testWorld == 1) ? "test world" : "maze world");
+#endif
+   printf("%-12s %10s %10s %10s %12s\n", "stage", "avg ms", "min ms",
+      "max ms", "total ms");
+   for(s=0; s<STAGE_COUNT; s++)
+      printf("%-12s %10.4f %10.4f %10.4f %12.2f\n", stageName[s],
+         total[s] / benchFrames, min[s], max[s], total[s]);
+   printf("%-12s %10s %10s %16s\n", "stage", "L1D miss", "LL miss",
+      "L1D misses/frame");
+   for(s=0; s<STAGE_COUNT; s++) {
+      printf("%-12s", stageName[s]);
+      printMissRate(cache[s][CACHE_L1_MISSES], cache[s][CACHE_L1_READS]);
+      printMissRate(cache[s][CACHE_LL_MISSES], cache[s][CACHE_LL_REFS]);
+      if (cache[s][CACHE_L1_MISSES] < 0)
+         printf(" %16s\n", "n/a");
+      else
+         printf(" %16lld\n", cache[s][CACHE_L1_MISSES] / benchFrames);
+   }
+   if (meshCubes == 1)
+      printf("chunks per frame: %ld  quads per frame: %ld\n",
+         chunks / benchFrames, quads / benchFrames);
+   else {
+      printf("cubes per frame: %ld\n", cubes / benchFrames);
+      printf("octree level %d, %d nodes, per frame: %ld visited %ld empty %ld hidden\n",
+         octreeLevel, octreeCount, visited / benchFrames, empty / benchFrames,
+         hidden / benchFrames);
+   }
+   printf("changed chunks: %ld\n", dirty);
+   if ((occlusion == 1) && (meshCubes == 1))
+      printf("occlusion per frame: %ld occluders, %ld chunks rejected\n",
+         occluders / benchFrames, occChunks / benchFrames);
+   else if (occlusion == 1)
+      printf("occlusion per frame: %ld occluders, %ld nodes %ld cubes rejected\n",
+         occluders / benchFrames, occNodes / benchFrames, occCubes / benchFrames);
+   printStreamStats();
+   checkChunks();
+}
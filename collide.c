@@ -0,0 +1,96 @@
+/* Swept box collision against the cubes of the world. A box is moved */
+/* one axis at a time, y then x then z. Along each axis it steps through */
+/* every layer of cubes its leading face enters, so it cannot pass */
+/* through a wall however far it moves in one call, and it stops flush */
+/* against the first layer with a non empty cube in it. Moving the axes */
+/* separately lets a box which hits a wall slide along it. The layers */
+/* are tested with the column runs from heightmap.c. */
+
+#include <math.h>
+
+#include "graphics.h"
+
+#define AXIS_X 0
+#define AXIS_Y 1
+#define AXIS_Z 2
+
+extern int columnSolid(int, int, int, int);
+
+/***********************/
+
+	/* first and last cube covered from lo to hi along one axis */
+void boxCells(float lo, float hi, int *first, int *last) {
+   *first = (int) floorf(lo);
+   *last = (int) ceilf(hi) - 1;
+   if (*last < *first)
+      *last = *first;
+}
+
+	/* returns 1 if any cube in layer number c along axis is not empty */
+	/* inside the cross section of box on the other two axes */
+int layerSolid(float box[6], int axis, int c) {
+int x0, x1, y0, y1, z0, z1, x, z;
+
+   boxCells(box[0], box[3], &x0, &x1);
+   boxCells(box[1], box[4], &y0, &y1);
+   boxCells(box[2], box[5], &z0, &z1);
+   if (axis == AXIS_X)
+      x0 = x1 = c;
+   else if (axis == AXIS_Z)
+      z0 = z1 = c;
+   else
+      y0 = y1 = c;
+   for(x=x0; x<=x1; x++)
+      for(z=z0; z<=z1; z++)
+         if (columnSolid(x, z, y0, y1 + 1) != 0)
+            return(1);
+   return(0);
+}
+
+	/* move box by distance along axis, box holds the low corner then */
+	/* the high corner, returns 1 if a cube stopped it */
+int sweepAxis(float box[6], int axis, float distance) {
+float lo, hi;
+int c, first, last;
+
+   lo = box[axis];
+   hi = box[axis + 3];
+   if (distance > 0.0) {
+		/* layers entered by the high face */
+      first = (int) ceilf(hi);
+      last = (int) ceilf(hi + distance) - 1;
+      for(c=first; c<=last; c++)
+         if (layerSolid(box, axis, c) == 1) {
+            distance = c - hi;
+            box[axis] += distance;
+            box[axis + 3] = c;
+            return(1);
+         }
+   } else if (distance < 0.0) {
+		/* layers entered by the low face */
+      first = (int) floorf(lo) - 1;
+      last = (int) floorf(lo + distance);
+      for(c=first; c>=last; c--)
+         if (layerSolid(box, axis, c) == 1) {
+            distance = (c + 1) - lo;
+            box[axis] = c + 1;
+            box[axis + 3] += distance;
+            return(1);
+         }
+   }
+   box[axis] += distance;
+   box[axis + 3] += distance;
+   return(0);
+}
+
+	/* move box by move[] in world coordinates, sliding along any cubes */
+	/* it hits, returns a bit for each axis which was stopped, bit 0 */
+	/* for x, bit 1 for y and bit 2 for z */
+int sweepBox(float box[6], float move[3]) {
+int hit;
+
+   hit = sweepAxis(box, AXIS_Y, move[AXIS_Y]) << AXIS_Y;
+   hit |= sweepAxis(box, AXIS_X, move[AXIS_X]) << AXIS_X;
+   hit |= sweepAxis(box, AXIS_Z, move[AXIS_Z]) << AXIS_Z;
+   return(hit);
+}
@@ -0,0 +1,425 @@
+/* Flow field used to walk mobs towards a target. Each cell of an x,z */
+/* area of the world holds the number of steps to the target cell over */
+/* cells a mob can stand in at one height, found with a breadth first */
+/* search, and a mob moves to the neighbouring cell with fewer steps. */
+/* The field is searched again from the start only when the target */
+/* moves to another cell. Cubes which change are passed in from */
+/* flushWorldDirty() and only the cells whose distance depended on a */
+/* cell which was filled, or which are closer through a cell which was */
+/* emptied, are changed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "graphics.h"
+
+	/* distance of a cell which cannot reach the target */
+#define FLOW_FAR 0x3fffffff
+
+extern int columnSolid(int, int, int, int);
+
+	/* area covered by the field from flowBX,flowBZ up to but not */
+	/* including flowTX,flowTZ, the height mobs stand at and the room */
+	/* above it they need, flowWidth is 0 until flowInit() is called */
+int flowBX, flowBZ, flowTX, flowTZ;
+int flowY = 1, flowHeight = 2;
+int flowWidth = 0, flowDepth = 0;
+	/* target cell and the cell the field was last searched from */
+int flowTargetX = -1, flowTargetZ = -1;
+int flowSearched = -1;
+	/* steps from each cell to the target and 1 for each cell a mob */
+	/* can stand in */
+int *flowDist = NULL;
+unsigned char *flowOpen = NULL;
+	/* cells whose cubes changed since the last updateFlowField(), each */
+	/* cell is in the list once while flowPending[] is 1 */
+int *flowChanged = NULL;
+int flowChangedCount = 0;
+unsigned char *flowPending = NULL;
+	/* set while a cell has lost its distance during a repair */
+unsigned char *flowLost = NULL;
+int *flowLostList = NULL;
+	/* binary heap of cells ordered by distance, a cell can be in it */
+	/* once for itself and once for each neighbour */
+int *flowHeapCell = NULL, *flowHeapDist = NULL;
+int flowHeapCount = 0;
+	/* full searches and repairs made and the cells they changed */
+int flowSearches = 0, flowRepairs = 0;
+long flowSearchCells = 0, flowRepairCells = 0;
+
+/***********************/
+
+	/* returns 1 if a mob can stand in the world at x,z */
+int flowStandable(int x, int z) {
+   return((columnSolid(x, z, flowY, flowY + flowHeight) == 0) &&
+      ((flowY == 0) || (columnSolid(x, z, flowY - 1, flowY) != 0)));
+}
+
+	/* allocate an array of count entries of size bytes */
+void *flowAlloc(int count, int size) {
+void *array;
+
+   array = calloc(count, size);
+   if (array == NULL) {
+      printf("ERROR: unable to allocate memory for the flow field\n");
+      exit(1);
+   }
+   return(array);
+}
+
+	/* cover the area from bx,bz up to but not including tx,tz with a */
+	/* field for mobs standing at height y with height cubes of room */
+void flowInit(int bx, int bz, int tx, int tz, int y, int height) {
+int cells;
+
+   if (bx < 0) bx = 0;
+   if (bz < 0) bz = 0;
+   if (tx > WORLDX) tx = WORLDX;
+   if (tz > WORLDZ) tz = WORLDZ;
+   if ((tx <= bx) || (tz <= bz)) {
+      printf("ERROR: the flow field area is empty\n");
+      exit(1);
+   }
+   flowBX = bx;
+   flowBZ = bz;
+   flowTX = tx;
+   flowTZ = tz;
+   flowY = y;
+   flowHeight = height;
+   flowWidth = tx - bx;
+   flowDepth = tz - bz;
+   cells = flowWidth * flowDepth;
+
+   free(flowDist);
+   free(flowOpen);
+   free(flowChanged);
+   free(flowPending);
+   free(flowLost);
+   free(flowLostList);
+   free(flowHeapCell);
+   free(flowHeapDist);
+   flowDist = flowAlloc(cells, sizeof(int));
+   flowOpen = flowAlloc(cells, 1);
+   flowChanged = flowAlloc(cells, sizeof(int));
+   flowPending = flowAlloc(cells, 1);
+   flowLost = flowAlloc(cells, 1);
+   flowLostList = flowAlloc(cells, sizeof(int));
+   flowHeapCell = flowAlloc(cells * 5 + 4, sizeof(int));
+   flowHeapDist = flowAlloc(cells * 5 + 4, sizeof(int));
+   flowChangedCount = 0;
+   flowSearched = -1;
+}
+
+	/* move the target to the cube at x,z */
+void setFlowTarget(int x, int z) {
+   flowTargetX = x;
+   flowTargetZ = z;
+}
+
+	/* the cubes from bx,bz up to but not including tx,tz changed, */
+	/* called by flushWorldDirty() */
+void dirtyFlowField(int bx, int bz, int tx, int tz) {
+int x, z, n;
+
+   if (flowWidth == 0)
+      return;
+   if (bx < flowBX) bx = flowBX;
+   if (bz < flowBZ) bz = flowBZ;
+   if (tx > flowTX) tx = flowTX;
+   if (tz > flowTZ) tz = flowTZ;
+   for(x=bx; x<tx; x++)
+      for(z=bz; z<tz; z++) {
+         n = (x - flowBX) * flowDepth + z - flowBZ;
+         if (flowPending[n] == 0) {
+            flowPending[n] = 1;
+            flowChanged[flowChangedCount++] = n;
+         }
+      }
+}
+
+	/* add cell n at distance d to the heap */
+void pushFlowHeap(int n, int d) {
+int i, p;
+
+   i = flowHeapCount++;
+   while (i > 0) {
+      p = (i - 1) / 2;
+      if (flowHeapDist[p] <= d)
+         break;
+      flowHeapCell[i] = flowHeapCell[p];
+      flowHeapDist[i] = flowHeapDist[p];
+      i = p;
+   }
+   flowHeapCell[i] = n;
+   flowHeapDist[i] = d;
+}
+
+	/* remove the cell with the smallest distance from the heap */
+int popFlowHeap(int *d) {
+int i, c, n, last, lastDist;
+
+   n = flowHeapCell[0];
+   *d = flowHeapDist[0];
+   flowHeapCount--;
+   last = flowHeapCell[flowHeapCount];
+   lastDist = flowHeapDist[flowHeapCount];
+   i = 0;
+   while ((c = i * 2 + 1) < flowHeapCount) {
+      if ((c + 1 < flowHeapCount) && (flowHeapDist[c + 1] < flowHeapDist[c]))
+         c++;
+      if (lastDist <= flowHeapDist[c])
+         break;
+      flowHeapCell[i] = flowHeapCell[c];
+      flowHeapDist[i] = flowHeapDist[c];
+      i = c;
+   }
+   flowHeapCell[i] = last;
+   flowHeapDist[i] = lastDist;
+   return(n);
+}
+
+	/* put the cells next to cell n in next[] and return how many */
+int flowNeighbours(int n, int next[4]) {
+int count, x, z;
+
+   count = 0;
+   x = n / flowDepth;
+   z = n % flowDepth;
+   if (x > 0) next[count++] = n - flowDepth;
+   if (x < flowWidth - 1) next[count++] = n + flowDepth;
+   if (z > 0) next[count++] = n - 1;
+   if (z < flowDepth - 1) next[count++] = n + 1;
+   return(count);
+}
+
+	/* take the cells in the heap in order of distance and lower the */
+	/* distance of their open neighbours which can be reached sooner */
+	/* through them, returns the number of cells changed */
+int relaxFlowField() {
+int next[4];
+int n, d, i, count, changed;
+
+   changed = 0;
+   while (flowHeapCount > 0) {
+      n = popFlowHeap(&d);
+      if (d > flowDist[n])
+         continue;
+      count = flowNeighbours(n, next);
+      for(i=0; i<count; i++)
+         if ((flowOpen[next[i]] == 1) && (flowDist[next[i]] > d + 1)) {
+            flowDist[next[i]] = d + 1;
+            pushFlowHeap(next[i], d + 1);
+            changed++;
+         }
+   }
+   return(changed);
+}
+
+	/* smallest distance of the open neighbours of cell n plus one */
+int flowThrough(int n) {
+int next[4];
+int i, count, best;
+
+   best = FLOW_FAR;
+   count = flowNeighbours(n, next);
+   for(i=0; i<count; i++)
+      if ((flowOpen[next[i]] == 1) && (flowDist[next[i]] + 1 < best))
+         best = flowDist[next[i]] + 1;
+   return(best);
+}
+
+	/* search the whole field from the target */
+void searchFlowField(int target) {
+int n, cells;
+
+   cells = flowWidth * flowDepth;
+   for(n=0; n<cells; n++) {
+      flowOpen[n] = flowStandable(flowBX + n / flowDepth, flowBZ + n % flowDepth);
+      flowDist[n] = FLOW_FAR;
+      flowPending[n] = 0;
+   }
+   flowChangedCount = 0;
+   flowSearched = target;
+   if (target < 0)
+      return;
+   flowDist[target] = 0;
+   flowHeapCount = 0;
+   pushFlowHeap(target, 0);
+   flowSearchCells += relaxFlowField() + 1;
+   flowSearches++;
+}
+
+	/* cell n was emptied, it and the cells behind it may now be */
+	/* closer to the target through it */
+int openFlowCell(int n) {
+   flowOpen[n] = 1;
+   if (n == flowSearched)
+      flowDist[n] = 0;
+   else
+      flowDist[n] = flowThrough(n);
+   if (flowDist[n] >= FLOW_FAR)
+      return(0);
+   flowHeapCount = 0;
+   pushFlowHeap(n, flowDist[n]);
+   return(relaxFlowField() + 1);
+}
+
+	/* cell n was filled, the cells which only had a shortest path */
+	/* through it lose their distance, taken in order of distance so a */
+	/* cell is only kept when a neighbour one step closer still has */
+	/* its distance, then the lost cells are given the distance through */
+	/* their neighbours which kept theirs */
+int closeFlowCell(int n) {
+int next[4], more[4];
+int i, j, count, moreCount, u, d, lost, best;
+
+   flowOpen[n] = 0;
+   if (flowDist[n] >= FLOW_FAR)
+      return(0);
+   flowDist[n] = FLOW_FAR;
+   lost = 0;
+
+   flowHeapCount = 0;
+   count = flowNeighbours(n, next);
+   for(i=0; i<count; i++)
+      if ((flowOpen[next[i]] == 1) && (flowDist[next[i]] < FLOW_FAR) &&
+          (next[i] != flowSearched))
+         pushFlowHeap(next[i], flowDist[next[i]]);
+   while (flowHeapCount > 0) {
+      u = popFlowHeap(&d);
+      if ((flowLost[u] == 1) || (d != flowDist[u]))
+         continue;
+      moreCount = flowNeighbours(u, more);
+      for(j=0; j<moreCount; j++)
+         if ((flowOpen[more[j]] == 1) && (flowDist[more[j]] == d - 1))
+            break;
+      if (j < moreCount)
+         continue;
+      flowLost[u] = 1;
+      flowLostList[lost++] = u;
+      flowDist[u] = FLOW_FAR;
+      for(j=0; j<moreCount; j++)
+         if ((flowOpen[more[j]] == 1) && (flowDist[more[j]] == d + 1) &&
+             (more[j] != flowSearched))
+            pushFlowHeap(more[j], d + 1);
+   }
+
+	/* the lost cells are given distances from the edge of the lost */
+	/* area inwards */
+   for(i=0; i<lost; i++) {
+      u = flowLostList[i];
+      flowLost[u] = 0;
+      best = flowThrough(u);
+      if (best < FLOW_FAR) {
+         flowDist[u] = best;
+         pushFlowHeap(u, best);
+      }
+   }
+   relaxFlowField();
+   return(lost + 1);
+}
+
+	/* bring the field up to date with the target and the cubes which */
+	/* changed, called once a tick before the mobs move */
+void updateFlowField() {
+int target, n, i, open, changed;
+
+   if (flowWidth == 0)
+      return;
+   if ((flowTargetX >= flowBX) && (flowTargetX < flowTX) &&
+       (flowTargetZ >= flowBZ) && (flowTargetZ < flowTZ))
+      target = (flowTargetX - flowBX) * flowDepth + flowTargetZ - flowBZ;
+   else
+      target = -1;
+   if (target != flowSearched) {
+      searchFlowField(target);
+      return;
+   }
+
+   changed = 0;
+   for(i=0; i<flowChangedCount; i++) {
+      n = flowChanged[i];
+      flowPending[n] = 0;
+      open = flowStandable(flowBX + n / flowDepth, flowBZ + n % flowDepth);
+      if (open == flowOpen[n])
+         continue;
+      if (open == 1)
+         changed += openFlowCell(n);
+      else
+         changed += closeFlowCell(n);
+   }
+   if (changed > 0) {
+      flowRepairs++;
+      flowRepairCells += changed;
+   }
+   flowChangedCount = 0;
+}
+
+	/* search the whole field again and return the number of cells */
+	/* whose distance differs from the one the repairs gave them */
+int checkFlowField() {
+int *kept;
+int n, cells, differ;
+
+   if (flowWidth == 0)
+      return(0);
+   cells = flowWidth * flowDepth;
+   kept = flowAlloc(cells, sizeof(int));
+   memcpy(kept, flowDist, sizeof(int) * cells);
+   searchFlowField(flowSearched);
+   differ = 0;
+   for(n=0; n<cells; n++)
+      if ((flowOpen[n] == 1) && (kept[n] != flowDist[n]))
+         differ++;
+   free(kept);
+   return(differ);
+}
+
+	/* returns the number of steps from x,z to the target or -1 if */
+	/* there is no way there */
+int flowDistance(float x, float z) {
+int cx, cz, n;
+
+   cx = (int) floorf(x);
+   cz = (int) floorf(z);
+   if ((flowWidth == 0) || (cx < flowBX) || (cx >= flowTX) ||
+       (cz < flowBZ) || (cz >= flowTZ))
+      return(-1);
+   n = (cx - flowBX) * flowDepth + cz - flowBZ;
+   return((flowDist[n] >= FLOW_FAR) ? -1 : flowDist[n]);
+}
+
+	/* set dx,dz to the direction from x,z towards the centre of the */
+	/* neighbouring cell closest to the target, returns 0 if there is */
+	/* no way to the target from x,z or it is already at the target */
+int flowDirection(float x, float z, float *dx, float *dz) {
+int next[4];
+int cx, cz, n, i, count, best;
+float ux, uz, length;
+
+   cx = (int) floorf(x);
+   cz = (int) floorf(z);
+   if ((flowWidth == 0) || (cx < flowBX) || (cx >= flowTX) ||
+       (cz < flowBZ) || (cz >= flowTZ))
+      return(0);
+   n = (cx - flowBX) * flowDepth + cz - flowBZ;
+   if ((flowDist[n] == 0) || (flowDist[n] >= FLOW_FAR))
+      return(0);
+   best = n;
+   count = flowNeighbours(n, next);
+   for(i=0; i<count; i++)
+      if ((flowOpen[next[i]] == 1) && (flowDist[next[i]] < flowDist[best]))
+         best = next[i];
+   if (best == n)
+      return(0);
+   ux = flowBX + best / flowDepth + 0.5 - x;
+   uz = flowBZ + best % flowDepth + 0.5 - z;
+   length = sqrtf(ux * ux + uz * uz);
+   if (length == 0.0)
+      return(0);
+   *dx = ux / length;
+   *dz = uz / length;
+   return(1);
+}
@@ -7,10 +7,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
 
 #include "graphics.h"
 
-#define MOB_COUNT 10
 #define PLAYER_COUNT 10
 
 extern void update();
@@ -18,6 +18,24 @@ extern void collisionResponse();
 extern void buildDisplayList();
 extern void mouse(int, int, int, int);
 extern void draw2D();
+extern void drawChunkMeshes();
+extern void setJobThreads(int);
+extern void worldInit(int, int, int);
+extern void loadWorld(char *);
+extern void streamInit();
+extern GLubyte getWorldCube(int, int, int);
+extern int drawInstancedCubes(int);
+extern void recordInput(int, int, int);
+extern char *recordFile;
+extern char *replayFile;
+extern char *frameTimesFile;
+extern void profileBegin(int);
+extern void profileEnd();
+extern void profileInit();
+extern int profiling;
+extern char *profileFile;
+extern int drawInstancedCreatures(float [][4], short [], int, GLfloat *,
+    GLfloat *, GLfloat *);
 
 
 /* flags used to control the appearance of the image */
@@ -60,20 +78,71 @@ int testWorld = 0;		// sample world for timing tests
 int fps = 0;			// turn on frame per second output
 int netClient = 0;		// network client flag, is client when = 1
 int netServer = 0;		// network server flag, is server when = 1
-
-/* list of cubes to display */
-int displayList[MAX_DISPLAY_LIST][3];
-int displayCount = 0;		// count of cubes in displayList[][]
-
-/* list of mobs - number of mobs, xyz values and rotation about y */
-float mobPosition[MOB_COUNT][4];
-/* visibility of mobs, 0 not drawn, 1 drawn */
-short mobVisible[MOB_COUNT];
+int meshCubes = 1;		// draw cached chunk geometry instead of single cubes
+int benchmark = 0;		// run headless benchmark instead of glutMainLoop
+int benchFrames = 1000;		// number of frames run by the benchmark
+int benchTime = 0;		// simulated elapsed time used by the benchmark
+int frustumBench = 0;		// cubes tested by the frustum micro-benchmark
+int worldBench = 0;		// random reads made by the world storage benchmark
+int collideBench = 0;		// bodies moved by the collision benchmark
+int mobBench = 0;		// mobs stepped by the mob benchmark
+int flowBench = 0;		// mobs walked through the maze by the flow benchmark
+int octreeLevel = 5;		// depth where the octree stops dividing nodes
+int instanced = 1;		// draw cubes, mobs and players with instancing
+int occlusion = 0;		// hide cubes behind nearby walls
+char *saveFile = NULL;		// world file written once the world is built
+char *loadFile = NULL;		// world file read instead of building the world
+int streamRadius = 0;		// chunks kept around the viewpoint when streaming
+int streamBudget = 4096;	// most unchanged chunks kept in memory when streaming
+char *chunkCheckFile = NULL;	// chunk checksums written or compared by -bench
+int tickRate = 60;		// simulation updates per second
+
+/* list of cubes to display, each entry is made by packCube() */
+unsigned int displayList[MAX_DISPLAY_LIST];
+int displayCount = 0;		// count of cubes in displayList[]
+/* the cubes of each colour are together in the list starting at */
+/* displayFirst[colour], displaySorted is 0 when cubes have been */
+/* added with addDisplayList() since the list was last sorted */
+int displayFirst[DISPLAY_COLOURS];
+int displayColourCount[DISPLAY_COLOURS];
+int displaySorted = 0;
+/* temporary space used to sort the display list */
+unsigned int *displaySort = NULL;
+
+/* the mobs are kept in mobs.c, the frustum culled ones are drawn */
+/* at the positions blendMobs() puts in mobDrawn */
+extern float (*mobDrawn)[4];
+extern int mobDrawCount;
+extern void saveMobPositions();
+extern void blendMobs(float);
+extern void tickMobs();
+extern void initMobArray();
 
 /* list of players - number of mobs, xyz values and rotation about y */
-float playerPosition[MOB_COUNT][4];
+float playerPosition[PLAYER_COUNT][4];
 /* visibility of players, 0 not drawn, 1 drawn */
-short playerVisible[MOB_COUNT];
+short playerVisible[PLAYER_COUNT];
+
+/* the simulation runs update() once per tick of 1/tickRate seconds */
+/* whatever the frame rate, simTicks counts the ticks run so far */
+int simTicks = 0;
+/* real time when simulate() last ran and the real time since the */
+/* last tick which has not been simulated yet, both in ms */
+int tickClock = -1;
+double tickLag = 0.0;
+/* most ticks run at once, the rest of a longer stall is dropped */
+#define MAX_CATCHUP_TICKS 5
+/* fraction of a tick between the last tick and the frame being drawn */
+float tickAlpha = 1.0;
+/* player positions before the last tick, the drawn positions */
+/* are blended from these towards the current ones by tickAlpha */
+float playerPrevious[PLAYER_COUNT][4];
+float playerDrawn[PLAYER_COUNT][4];
+/* movement keys pressed since the last tick, the viewpoint is only */
+/* moved by them at the start of the next tick */
+#define MAX_QUEUED_MOVES 64
+unsigned char queuedMove[MAX_QUEUED_MOVES];
+int queuedMoveCount = 0;
 
 /* flag indicating the user wants the cube in front of them removed */
 int space = 0;
@@ -94,11 +163,12 @@ void  set2Dcolour(float []);
 /* set all player location, rotation, and visibility values to zero */
 void initPlayerArray() {
     int i;
-    for (i=0; i<MOB_COUNT; i++) {
+    for (i=0; i<PLAYER_COUNT; i++) {
         playerPosition[i][0] = 0.0;
         playerPosition[i][1] = 0.0;
         playerPosition[i][2] = 0.0;
         playerPosition[i][3] = 0.0;
+        memcpy(playerPrevious[i], playerPosition[i], sizeof(playerPosition[i]));
         playerVisible[i] = 0;
     }
 }
@@ -114,6 +184,7 @@ void createPlayer(int number, float x, float y, float z, float playerroty) {
     playerPosition[number][1] = y;
     playerPosition[number][2] = z;
     playerPosition[number][3] = playerroty;
+    memcpy(playerPrevious[number], playerPosition[number], sizeof(playerPosition[number]));
     playerVisible[number] = 1;
 }
 
@@ -149,66 +220,6 @@ void showPlayer(int number) {
 
 
 
-/* mob control functions */
-/* set all mob location, rotation, and visibility values to zero */
-void initMobArray() {
-    int i;
-    for (i=0; i<MOB_COUNT; i++) {
-        mobPosition[i][0] = 0.0;
-        mobPosition[i][1] = 0.0;
-        mobPosition[i][2] = 0.0;
-        mobPosition[i][3] = 0.0;
-        mobVisible[i] = 0;
-    }
-}
-
-/* create mob with identifier "number" at x,y,z with */
-/* heading of rotx, roty, rotz */
-void createMob(int number, float x, float y, float z, float mobroty) {
-    if (number >= MOB_COUNT) {
-        printf("ERROR: mob number greater than %d\n", MOB_COUNT);
-        exit(1);
-    }
-    mobPosition[number][0] = x;
-    mobPosition[number][1] = y;
-    mobPosition[number][2] = z;
-    mobPosition[number][3] = mobroty;
-    mobVisible[number] = 1;
-}
-
-/* move mob to a new position xyz with rotation rotx,roty,rotz */
-void setMobPosition(int number, float x, float y, float z, float mobroty){
-    if (number >= MOB_COUNT) {
-        printf("ERROR: mob number greater than %d\n", MOB_COUNT);
-        exit(1);
-    }
-    mobPosition[number][0] = x;
-    mobPosition[number][1] = y;
-    mobPosition[number][2] = z;
-    mobPosition[number][3] = mobroty;
-}
-
-/* turn off drawing for mob number */
-void hideMob(int number) {
-    if (number >= MOB_COUNT) {
-        printf("ERROR: mob number greater than %d\n", MOB_COUNT);
-        exit(1);
-    }
-    mobVisible[number] = 0;
-}
-
-/* turn on drawing for mob number */
-void showMob(int number) {
-    if (number >= MOB_COUNT) {
-        printf("ERROR: mob number greater than %d\n", MOB_COUNT);
-        exit(1);
-    }
-    mobVisible[number] = 1;
-}
-
-
-
-
 /* allows user to set position of the light */
 void setLightPosition(GLfloat x, GLfloat y, GLfloat z) {
     lightPosition[0] = x;
@@ -242,6 +253,14 @@ void getOldViewPosition(float *x, float *y, float *z) {
     *z = oldvpz;
 }
 
+/* sets the previous location of the viewpoint, used when the */
+/* viewpoint is moved by something other than the keyboard */
+void setOldViewPosition(float x, float y, float z) {
+    oldvpx = x;
+    oldvpy = y;
+    oldvpz = z;
+}
+
 /* sets the current orientation of the viewpoint */
 void setViewOrientation(float xaxis, float yaxis, float zaxis) {
     mvx = xaxis;
@@ -256,22 +275,188 @@ void getViewOrientation(float *xaxis, float *yaxis, float *zaxis) {
     *zaxis = mvz;
 }
 
-/* add the cube at world[x][y][z] to the display list and */
+/* returns the number of milliseconds of simulated time, the clock */
+/* moves by one tick each time update() is called so the simulation */
+/* behaves the same on any machine, the benchmark uses its own clock */
+/* but a replay runs on ticks like the recorded session did */
+int getElapsedTime() {
+    if ((benchmark == 1) && (replayFile == NULL))
+        return(benchTime);
+    return((int) ((long long) simTicks * 1000 / tickRate));
+}
+
+/* move the viewpoint for one of the movement keys and keep it out */
+/* of the walls */
+void moveViewpoint(unsigned char key) {
+    float rotx, roty;
+
+    switch (key) {
+        case 'w':		// forward motion
+            oldvpx = vpx;
+            oldvpy = vpy;
+            oldvpz = vpz;
+            rotx = (mvx / 180.0 * 3.141592);
+            roty = (mvy / 180.0 * 3.141592);
+            vpx -= sin(roty) * 0.3;
+            // turn off y motion so you can't fly
+            if (flycontrol == 1)
+            vpy += sin(rotx) * 0.3;
+            vpz += cos(roty) * 0.3;
+            collisionResponse();
+            break;
+        case 's':		// backward motion
+            oldvpx = vpx;
+            oldvpy = vpy;
+            oldvpz = vpz;
+            rotx = (mvx / 180.0 * 3.141592);
+            roty = (mvy / 180.0 * 3.141592);
+            vpx += sin(roty) * 0.3;
+            // turn off y motion so you can't fly
+            if (flycontrol == 1)
+            vpy -= sin(rotx) * 0.3;
+            vpz -= cos(roty) * 0.3;
+            collisionResponse();
+            break;
+        case 'a':		// strafe left motion
+            oldvpx = vpx;
+            oldvpy = vpy;
+            oldvpz = vpz;
+            roty = (mvy / 180.0 * 3.141592);
+            vpx += cos(roty) * 0.3;
+            vpz += sin(roty) * 0.3;
+            collisionResponse();
+            break;
+        case 'd':		// strafe right motion
+            oldvpx = vpx;
+            oldvpy = vpy;
+            oldvpz = vpz;
+            roty = (mvy / 180.0 * 3.141592);
+            vpx -= cos(roty) * 0.3;
+            vpz -= sin(roty) * 0.3;
+            collisionResponse();
+            break;
+    }
+}
+
+/* apply the movement keys queued since the last tick, called at the */
+/* start of each tick before the simulated time moves on */
+void runQueuedMoves() {
+    int i;
+
+    for(i=0; i<queuedMoveCount; i++)
+        moveViewpoint(queuedMove[i]);
+    queuedMoveCount = 0;
+}
+
+/* called when there are no other events, runs update() once for each */
+/* tick of real time which has passed and redraws the screen after */
+/* them, when no tick is due it sleeps until the next one */
+void simulate() {
+    double tick;
+    int now, ticks;
+
+    tick = 1000.0 / tickRate;
+    now = glutGet(GLUT_ELAPSED_TIME);
+    if (tickClock < 0)
+        tickClock = now;
+    tickLag += now - tickClock;
+    tickClock = now;
+    if (tickLag > MAX_CATCHUP_TICKS * tick)
+        tickLag = MAX_CATCHUP_TICKS * tick;
+
+    for(ticks=0; tickLag >= tick; ticks++) {
+        saveMobPositions();
+        memcpy(playerPrevious, playerPosition, sizeof(playerPosition));
+        runQueuedMoves();
+        simTicks++;
+        profileBegin(PROFILE_UPDATE);
+        update();
+        tickMobs();
+        profileEnd();
+        tickLag -= tick;
+    }
+    tickAlpha = tickLag / tick;
+
+    if (ticks > 0)
+        glutPostRedisplay();
+    else
+        usleep((useconds_t) ((tick - tickLag) * 1000.0));
+}
+
+/* blend a rotation about y from previous towards current by alpha */
+/* turning the short way around */
+float blendAngle(float previous, float current, float alpha) {
+    float turn;
+
+    turn = current - previous;
+    if (turn > 180.0)
+        turn -= 360.0;
+    else if (turn < -180.0)
+        turn += 360.0;
+    return(previous + alpha * turn);
+}
+
+/* blend count positions from previous towards current by tickAlpha */
+/* and put them in drawn */
+void blendPositions(float drawn[][4], float previous[][4],
+    float current[][4], int count) {
+    int i, j;
+
+    for(i=0; i<count; i++) {
+        for(j=0; j<3; j++)
+            drawn[i][j] = previous[i][j] +
+                tickAlpha * (current[i][j] - previous[i][j]);
+        drawn[i][3] = blendAngle(previous[i][3], current[i][3], tickAlpha);
+    }
+}
+
+/* add the cube at x,y,z in the world to the display list and */
 /* increment displayCount */
 int addDisplayList(int x, int y, int z) {
-    displayList[displayCount][0] = x;
-    displayList[displayCount][1] = y;
-    displayList[displayCount][2] = z;
-    displayCount++;
-    if (displayCount > MAX_DISPLAY_LIST) {
+    if (displayCount == MAX_DISPLAY_LIST) {
         printf("You have put more items in the display list then there are\n");
         printf("cubes in the world. Set displayCount = 0 at some point.\n");
         exit(1);
     }
+    displayList[displayCount] = packCube(x, y, z, getWorldCube(x, y, z));
+    displayCount++;
+    displaySorted = 0;
 
     return 0;//TODO: IS THIS RIGHT?!l
 }
 
+/* group the cubes in the display list by colour, the order of the */
+/* cubes with the same colour does not change */
+void sortDisplayList() {
+    int i, c, total;
+
+    if (displaySort == NULL) {
+        displaySort = malloc(sizeof(unsigned int) * MAX_DISPLAY_LIST);
+        if (displaySort == NULL) {
+            printf("ERROR: unable to allocate memory to sort the display list\n");
+            exit(1);
+        }
+    }
+
+    for(c=0; c<DISPLAY_COLOURS; c++)
+        displayColourCount[c] = 0;
+    for(i=0; i<displayCount; i++)
+        displayColourCount[cubeColour(displayList[i])]++;
+    total = 0;
+    for(c=0; c<DISPLAY_COLOURS; c++) {
+        displayFirst[c] = total;
+        total += displayColourCount[c];
+    }
+    for(i=0; i<displayCount; i++) {
+        c = cubeColour(displayList[i]);
+        displaySort[displayFirst[c]++] = displayList[i];
+    }
+    for(c=0; c<DISPLAY_COLOURS; c++)
+        displayFirst[c] -= displayColourCount[c];
+    memcpy(displayList, displaySort, sizeof(unsigned int) * displayCount);
+    displaySorted = 1;
+}
+
 
 
 /*  Initialize material property and light source.  */
@@ -316,8 +501,8 @@ void init (void)
 
 }
 
-/* draw cube in world[i][j][k] */
-void drawCube(int i, int j, int k) {
+/* set the material used to draw cubes of the given colour */
+void setCubeMaterial(int colour) {
     GLfloat blue[]  = {0.0, 0.0, 1.0, 1.0};
     GLfloat red[]   = {1.0, 0.0, 0.0, 1.0};
     GLfloat green[] = {0.0, 1.0, 0.0, 1.0};
@@ -338,29 +523,29 @@ void drawCube(int i, int j, int k) {
     /* select colour based on value in the world array */
     glMaterialfv(GL_FRONT, GL_SPECULAR, white);
 
-    if (world[i][j][k] == 1) {
+    if (colour == 1) {
         glMaterialfv(GL_FRONT, GL_AMBIENT, dgreen);
         glMaterialfv(GL_FRONT, GL_DIFFUSE, green);
     }
-    else if (world[i][j][k] == 2) {
+    else if (colour == 2) {
         glMaterialfv(GL_FRONT, GL_AMBIENT, dblue);
         glMaterialfv(GL_FRONT, GL_DIFFUSE, blue);
     }
-    else if (world[i][j][k] == 3) {
+    else if (colour == 3) {
         glMaterialfv(GL_FRONT, GL_AMBIENT, dred);
         glMaterialfv(GL_FRONT, GL_DIFFUSE, red);
     }
-    else if (world[i][j][k] == 4) {
+    else if (colour == 4) {
         glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, black);
     }
-    else if (world[i][j][k] == 5) {
+    else if (colour == 5) {
         glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, white);
     }
-    else if (world[i][j][k] == 6) {
+    else if (colour == 6) {
         glMaterialfv(GL_FRONT, GL_AMBIENT, dpurple);
         glMaterialfv(GL_FRONT, GL_DIFFUSE, purple);
     }
-    else if (world[i][j][k] == 7) {
+    else if (colour == 7) {
         glMaterialfv(GL_FRONT, GL_AMBIENT, dorange);
         glMaterialfv(GL_FRONT, GL_DIFFUSE, orange);
     }
@@ -368,6 +553,11 @@ void drawCube(int i, int j, int k) {
         glMaterialfv(GL_FRONT, GL_AMBIENT, dyellow);
         glMaterialfv(GL_FRONT, GL_DIFFUSE, yellow);
     }
+}
+
+/* draw the cube at i,j,k in the world */
+void drawCube(int i, int j, int k) {
+    setCubeMaterial(getWorldCube(i, j, k));
 
     glPushMatrix ();
     /* offset cubes by 0.5 so the centre of the */
@@ -387,7 +577,7 @@ void display (void)
     GLfloat red[] = {1.0, 0.0, 0.0, 1.0};
     GLfloat gray[] = {0.3, 0.3, 0.3, 1.0};
     GLfloat white[] = {1.0, 1.0, 1.0, 1.0};
-    int i, j, k;
+    int i, j, k, c, last;
 
     buildDisplayList();
     glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -444,39 +634,48 @@ void display (void)
     /* turn off emision lighting, use only for sky */
     glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, black);
 
-    /* draw mobs in the world */
-    for(i=0; i<MOB_COUNT; i++) {
-        if (mobVisible[i] == 1) {
-            glPushMatrix();
-            /* black body */
-            glTranslatef(mobPosition[i][0]+0.5, mobPosition[i][1]+0.5,
-                mobPosition[i][2]+0.5);
-                glMaterialfv(GL_FRONT, GL_AMBIENT, black);
-                glMaterialfv(GL_FRONT, GL_DIFFUSE, gray);
-                glutSolidSphere(0.5, 8, 8);
-                /* white eyes */
-                glRotatef(mobPosition[i][3], 0.0, 1.0, 0.0);
-                glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, white);
-                glTranslatef(0.3, 0.1, 0.3);
-                glutSolidSphere(0.1, 4, 4);
-                glTranslatef(-0.6, 0.0, 0.0);
-                glutSolidSphere(0.1, 4, 4);
-                glPopMatrix();
-            }
-        }
+    /* mobs and players are drawn between where they were before and */
+    /* after the last tick so they move smoothly between ticks */
+    profileBegin(PROFILE_MOBS);
+    blendMobs(tickAlpha);
+    blendPositions(playerDrawn, playerPrevious, playerPosition, PLAYER_COUNT);
+
+    /* draw the mobs inside the frustum, all at once when instancing */
+    /* is used */
+    if (drawInstancedCreatures(mobDrawn, NULL, mobDrawCount, black,
+        gray, white) == 0)
+    for(i=0; i<mobDrawCount; i++) {
+        glPushMatrix();
+        /* black body */
+        glTranslatef(mobDrawn[i][0]+0.5, mobDrawn[i][1]+0.5,
+            mobDrawn[i][2]+0.5);
+        glMaterialfv(GL_FRONT, GL_AMBIENT, black);
+        glMaterialfv(GL_FRONT, GL_DIFFUSE, gray);
+        glutSolidSphere(0.5, 8, 8);
+        /* white eyes */
+        glRotatef(mobDrawn[i][3], 0.0, 1.0, 0.0);
+        glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, white);
+        glTranslatef(0.3, 0.1, 0.3);
+        glutSolidSphere(0.1, 4, 4);
+        glTranslatef(-0.6, 0.0, 0.0);
+        glutSolidSphere(0.1, 4, 4);
+        glPopMatrix();
+    }
 
-        /* draw players in the world */
+        /* draw players in the world, all at once when instancing is used */
+        if (drawInstancedCreatures(playerDrawn, playerVisible, PLAYER_COUNT,
+            white, gray, red) == 0)
         for(i=0; i<PLAYER_COUNT; i++) {
             if (playerVisible[i] == 1) {
                 glPushMatrix();
                 /* black body */
-                glTranslatef(playerPosition[i][0]+0.5, playerPosition[i][1]+0.5,
-                    playerPosition[i][2]+0.5);
+                glTranslatef(playerDrawn[i][0]+0.5, playerDrawn[i][1]+0.5,
+                    playerDrawn[i][2]+0.5);
                     glMaterialfv(GL_FRONT, GL_AMBIENT, white);
                     glMaterialfv(GL_FRONT, GL_DIFFUSE, gray);
                     glutSolidSphere(0.5, 8, 8);
                     /* white eyes */
-                    glRotatef(playerPosition[i][3], 0.0, 1.0, 0.0);
+                    glRotatef(playerDrawn[i][3], 0.0, 1.0, 0.0);
                     glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, red);
                     glTranslatef(0.3, 0.1, 0.3);
                     glutSolidSphere(0.1, 4, 4);
@@ -486,28 +685,49 @@ void display (void)
                 }
             }
 
+            profileEnd();
+
             /* draw all cubes in the world array */
+            profileBegin(PROFILE_CUBES);
             if (displayAllCubes == 1) {
                 /* draw all cubes */
                 for(i=0; i<WORLDX; i++) {
                     for(j=0; j<WORLDY; j++) {
                         for(k=0; k<WORLDZ; k++) {
-                            if (world[i][j][k] != 0) {
+                            if (getWorldCube(i, j, k) != 0) {
                                 drawCube(i, j, k);
                             }
                         }
                     }
                 }
+            } else if (meshCubes == 1) {
+                /* draw the cached geometry of the chunks which */
+                /* were found to be visible in buildDisplayList() */
+                drawChunkMeshes();
             } else {
                 /* draw only the cubes in the displayList */
                 /* these should have been selected in the update function */
-
-                for(i=0; i<displayCount; i++) {
-                    drawCube(displayList[i][0],
-                        displayList[i][1],
-                        displayList[i][2]);
+                /* the material is set once for each colour */
+                if (displaySorted == 0)
+                    sortDisplayList();
+                /* with instancing each colour is drawn with one call */
+                if (drawInstancedCubes(displayCount) == 0)
+                for(c=1; c<DISPLAY_COLOURS; c++) {
+                    if (displayColourCount[c] == 0)
+                        continue;
+                    setCubeMaterial(c);
+                    last = displayFirst[c] + displayColourCount[c];
+                    for(i=displayFirst[c]; i<last; i++) {
+                        glPushMatrix ();
+                        glTranslatef(cubeX(displayList[i]) + 0.5,
+                            cubeY(displayList[i]) + 0.5,
+                            cubeZ(displayList[i]) + 0.5);
+                        glutSolidCube(1.0);
+                        glPopMatrix ();
                     }
                 }
+            }
+            profileEnd();
 
 
 
@@ -558,12 +778,23 @@ void display (void)
 
             }
 
+            /* ask for the screen to be redrawn, there is no window when */
+            /* a recording is replayed */
+            void postRedisplay() {
+                if (benchmark == 0)
+                glutPostRedisplay();
+            }
+
             /* respond to keyboard events */
             void keyboard(unsigned char key, int x, int y)
             {
-                float rotx, roty;
         //        static int lighton = 1;
 
+                recordInput(REPLAY_KEY, key, 0);
+                /* the drawing style keys need a GL context */
+                if ((benchmark == 1) && (key >= '1') && (key <= '5'))
+                return;
+
                 switch (key) {
                     case 27:
                     case 'q':
@@ -575,7 +806,7 @@ void display (void)
                     smoothShading = 0;
                     textures = 0;
                     init();
-                    glutPostRedisplay();
+                    postRedisplay();
                     break;
                     case '2':		// draw polygons as filled
                     lineDrawing = 0;
@@ -583,7 +814,7 @@ void display (void)
                     smoothShading = 0;
                     textures = 0;
                     init();
-                    glutPostRedisplay();
+                    postRedisplay();
                     break;
                     case '3':		// diffuse and specular lighting, flat shading
                     lineDrawing = 0;
@@ -591,7 +822,7 @@ void display (void)
                     smoothShading = 0;
                     textures = 0;
                     init();
-                    glutPostRedisplay();
+                    postRedisplay();
                     break;
                     case '4':		// diffuse and specular lighting, smooth shading
                     lineDrawing = 0;
@@ -599,7 +830,7 @@ void display (void)
                     smoothShading = 1;
                     textures = 0;
                     init();
-                    glutPostRedisplay();
+                    postRedisplay();
                     break;
                     case '5':		// texture with  smooth shading
                     lineDrawing = 0;
@@ -607,55 +838,14 @@ void display (void)
                     smoothShading = 1;
                     textures = 1;
                     init();
-                    glutPostRedisplay();
+                    postRedisplay();
                     break;
                     case 'w':		// forward motion
-                    oldvpx = vpx;
-                    oldvpy = vpy;
-                    oldvpz = vpz;
-                    rotx = (mvx / 180.0 * 3.141592);
-                    roty = (mvy / 180.0 * 3.141592);
-                    vpx -= sin(roty) * 0.3;
-                    // turn off y motion so you can't fly
-                    if (flycontrol == 1)
-                    vpy += sin(rotx) * 0.3;
-                    vpz += cos(roty) * 0.3;
-                    collisionResponse();
-                    glutPostRedisplay();
-                    break;
                     case 's':		// backward motion
-                    oldvpx = vpx;
-                    oldvpy = vpy;
-                    oldvpz = vpz;
-                    rotx = (mvx / 180.0 * 3.141592);
-                    roty = (mvy / 180.0 * 3.141592);
-                    vpx += sin(roty) * 0.3;
-                    // turn off y motion so you can't fly
-                    if (flycontrol == 1)
-                    vpy -= sin(rotx) * 0.3;
-                    vpz -= cos(roty) * 0.3;
-                    collisionResponse();
-                    glutPostRedisplay();
-                    break;
                     case 'a':		// strafe left motion
-                    oldvpx = vpx;
-                    oldvpy = vpy;
-                    oldvpz = vpz;
-                    roty = (mvy / 180.0 * 3.141592);
-                    vpx += cos(roty) * 0.3;
-                    vpz += sin(roty) * 0.3;
-                    collisionResponse();
-                    glutPostRedisplay();
-                    break;
                     case 'd':		// strafe right motion
-                    oldvpx = vpx;
-                    oldvpy = vpy;
-                    oldvpz = vpz;
-                    roty = (mvy / 180.0 * 3.141592);
-                    vpx -= cos(roty) * 0.3;
-                    vpz -= sin(roty) * 0.3;
-                    collisionResponse();
-                    glutPostRedisplay();
+                    if (queuedMoveCount < MAX_QUEUED_MOVES)
+                    queuedMove[queuedMoveCount++] = key;
                     break;
                     case 'f':		// toggle flying controls
                     if (flycontrol == 0) flycontrol = 1;
@@ -712,6 +902,7 @@ void display (void)
 
                 /* responds to mouse movement when a button is pressed */
                 void motion(int x, int y) {
+                    recordInput(REPLAY_DRAG, x, y);
                     /* update current mouse movement but don't use to change the viewpoint*/
                     oldx = x;
                     oldy = y;
@@ -719,11 +910,12 @@ void display (void)
 
                 /* responds to mouse movement when a button is not pressed */
                 void passivemotion(int x, int y) {
+                    recordInput(REPLAY_LOOK, x, y);
                     mvx += (float) y - oldy;
                     mvy += (float) x - oldx;
                     oldx = x;
                     oldy = y;
-                    glutPostRedisplay();
+                    postRedisplay();
                 }
 
 
@@ -731,12 +923,13 @@ void display (void)
                 /* initilize graphics information and mob data structure */
                 void graphicsInit(int *argc, char **argv) {
                     int i, fullscreen;
-                    /* set GL window information */
-                    glutInit(argc, argv);
-                    glutInitDisplayMode (GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
+                    int sizex, sizey, sizez;
 
                     /* parse command line args */
                     fullscreen = 0;
+                    sizex = 100;
+                    sizey = 50;
+                    sizez = 100;
                     for(i=1; i<*argc; i++) {
                         if (strcmp(argv[i],"-full") == 0)
                         fullscreen = 1;
@@ -750,33 +943,147 @@ void display (void)
                         netClient = 1;
                         if (strcmp(argv[i],"-server") == 0)
                         netServer = 1;
+                        if (strcmp(argv[i],"-cubes") == 0)
+                        meshCubes = 0;
+                        if (strcmp(argv[i],"-bench") == 0) {
+                            benchmark = 1;
+                            /* optional frame count follows the flag */
+                            if ((i+1 < *argc) && (atoi(argv[i+1]) > 0))
+                            benchFrames = atoi(argv[++i]);
+                        }
+                        if (strcmp(argv[i],"-immediate") == 0)
+                        instanced = 0;
+                        if (strcmp(argv[i],"-occlusion") == 0)
+                        occlusion = 1;
+                        if ((strcmp(argv[i],"-octree") == 0) && (i+1 < *argc))
+                        octreeLevel = atoi(argv[++i]);
+                        if ((strcmp(argv[i],"-threads") == 0) && (i+1 < *argc))
+                        setJobThreads(atoi(argv[++i]));
+                        if (strcmp(argv[i],"-frustumbench") == 0) {
+                            benchmark = 1;
+                            frustumBench = 1000000;
+                            /* optional cube count follows the flag */
+                            if ((i+1 < *argc) && (atoi(argv[i+1]) > 0))
+                            frustumBench = atoi(argv[++i]);
+                        }
+                        if ((strcmp(argv[i],"-world") == 0) && (i+1 < *argc)) {
+                            if (sscanf(argv[++i], "%dx%dx%d", &sizex, &sizey,
+                                &sizez) != 3) {
+                                printf("ERROR: -world expects a size such as 1024x128x1024\n");
+                                exit(1);
+                            }
+                        }
+                        if ((strcmp(argv[i],"-save") == 0) && (i+1 < *argc))
+                        saveFile = argv[++i];
+                        if ((strcmp(argv[i],"-load") == 0) && (i+1 < *argc))
+                        loadFile = argv[++i];
+                        if ((strcmp(argv[i],"-stream") == 0) && (i+1 < *argc))
+                        streamRadius = atoi(argv[++i]);
+                        if ((strcmp(argv[i],"-streambudget") == 0) && (i+1 < *argc))
+                        streamBudget = atoi(argv[++i]);
+                        if ((strcmp(argv[i],"-chunkcheck") == 0) && (i+1 < *argc))
+                        chunkCheckFile = argv[++i];
+                        if ((strcmp(argv[i],"-tick") == 0) && (i+1 < *argc))
+                        tickRate = atoi(argv[++i]);
+                        if ((strcmp(argv[i],"-record") == 0) && (i+1 < *argc))
+                        recordFile = argv[++i];
+                        if ((strcmp(argv[i],"-replay") == 0) && (i+1 < *argc)) {
+                            benchmark = 1;
+                            replayFile = argv[++i];
+                        }
+                        if ((strcmp(argv[i],"-frametimes") == 0) && (i+1 < *argc))
+                        frameTimesFile = argv[++i];
+                        if (strcmp(argv[i],"-profile") == 0) {
+                            profiling = 1;
+                            /* optional file name follows the flag */
+                            if ((i+1 < *argc) && (argv[i+1][0] != '-'))
+                            profileFile = argv[++i];
+                        }
+                        if (strcmp(argv[i],"-collidebench") == 0) {
+                            benchmark = 1;
+                            collideBench = 10000;
+                            /* optional body count follows the flag */
+                            if ((i+1 < *argc) && (atoi(argv[i+1]) > 0))
+                            collideBench = atoi(argv[++i]);
+                        }
+                        if (strcmp(argv[i],"-mobbench") == 0) {
+                            benchmark = 1;
+                            mobBench = 10000;
+                            /* optional mob count follows the flag */
+                            if ((i+1 < *argc) && (atoi(argv[i+1]) > 0))
+                            mobBench = atoi(argv[++i]);
+                        }
+                        if (strcmp(argv[i],"-flowbench") == 0) {
+                            benchmark = 1;
+                            flowBench = 500;
+                            /* optional mob count follows the flag */
+                            if ((i+1 < *argc) && (atoi(argv[i+1]) > 0))
+                            flowBench = atoi(argv[++i]);
+                        }
+                        if (strcmp(argv[i],"-worldbench") == 0) {
+                            benchmark = 1;
+                            worldBench = 1000000;
+                            /* optional read count follows the flag */
+                            if ((i+1 < *argc) && (atoi(argv[i+1]) > 0))
+                            worldBench = atoi(argv[++i]);
+                        }
                         if (strcmp(argv[i],"-help") == 0) {
-                            printf("Usage: a4 [-full] [-drawall] [-testworld] [-fps] [-client] [-server]\n");
+                            printf("Usage: a4 [-full] [-drawall] [-testworld] [-fps] [-client] [-server] [-cubes] [-bench [frames]] [-frustumbench [cubes]] [-worldbench [reads]] [-collidebench [bodies]] [-mobbench [mobs]] [-flowbench [mobs]] [-octree level] [-threads count] [-immediate] [-occlusion] [-world XxYxZ] [-save file] [-load file] [-stream radius] [-streambudget chunks] [-chunkcheck file] [-tick rate] [-record file] [-replay file] [-frametimes file] [-profile [file]]\n");
                             exit(0);
                         }
                     }
 
-                    if (fullscreen == 1) {
-                        glutGameModeString("1024x768:32@75");
-                        glutEnterGameMode();
-                    } else {
-                        glutInitWindowSize (screenWidth, screenHeight);
-                        glutCreateWindow (argv[0]);
+                    if (tickRate < 1) {
+                        printf("ERROR: -tick needs a rate of at least 1 update per second\n");
+                        exit(1);
                     }
 
-                    init();
+                    profileInit();
+
+                    /* allocate the empty world before it is built, a loaded */
+                    /* world file sets the size of the world */
+                    if (loadFile != NULL)
+                    loadWorld(loadFile);
+                    else
+                    worldInit(sizex, sizey, sizez);
+
+                    /* only the chunks near the viewpoint are kept in memory */
+                    if (streamRadius > 0) {
+                        if (loadFile == NULL) {
+                            printf("ERROR: -stream needs a world file given with -load\n");
+                            exit(1);
+                        }
+                        streamInit();
+                    }
+
+                    /* the benchmark runs without a window or GL context */
+                    if (benchmark == 0) {
+                        /* set GL window information */
+                        glutInit(argc, argv);
+                        glutInitDisplayMode (GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
+
+                        if (fullscreen == 1) {
+                            glutGameModeString("1024x768:32@75");
+                            glutEnterGameMode();
+                        } else {
+                            glutInitWindowSize (screenWidth, screenHeight);
+                            glutCreateWindow (argv[0]);
+                        }
 
-                    /* not used at the moment */
-                    //   loadTexture();
-
-                    /* attach functions to GL events */
-                    glutReshapeFunc (reshape);
-                    glutDisplayFunc(display);
-                    glutKeyboardFunc (keyboard);
-                    glutPassiveMotionFunc(passivemotion);
-                    glutMotionFunc(motion);
-                    glutMouseFunc(mouse);
-                    glutIdleFunc(update);
+                        init();
+
+                        /* not used at the moment */
+                        //   loadTexture();
+
+                        /* attach functions to GL events */
+                        glutReshapeFunc (reshape);
+                        glutDisplayFunc(display);
+                        glutKeyboardFunc (keyboard);
+                        glutPassiveMotionFunc(passivemotion);
+                        glutMotionFunc(motion);
+                        glutMouseFunc(mouse);
+                        glutIdleFunc(simulate);
+                    }
 
 
                     /* initialize mob and player array to empty */
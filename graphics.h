@@ -1,23 +1,140 @@
 #ifdef __APPLE__
 #include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
 #include <OpenGL/glu.h>
 #include <GLUT/glut.h>
 #elif _WIN32
 #include <windows.h>
 #include <GL/glut.h>
 #else
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <GL/glut.h>
 #endif
 
-/* world size and storage array */
-#define WORLDX 100
-#define WORLDY 50
-#define WORLDZ 100
-GLubyte  world[WORLDX][WORLDY][WORLDZ];
+/* world size, set at startup with -world, the default is 100x50x100 */
+/* and the display list packing limits it to 1024x256x1024 */
+extern int worldX, worldY, worldZ;
+#define WORLDX worldX
+#define WORLDY worldY
+#define WORLDZ worldZ
+#define MAX_WORLDX 1024
+#define MAX_WORLDY 256
+#define MAX_WORLDZ 1024
+
+/* the world is stored in chunks which also cache their geometry */
+#define CHUNK_SIZE 16
+#define CHUNKX ((WORLDX + CHUNK_SIZE - 1) / CHUNK_SIZE)
+#define CHUNKY ((WORLDY + CHUNK_SIZE - 1) / CHUNK_SIZE)
+#define CHUNKZ ((WORLDZ + CHUNK_SIZE - 1) / CHUNK_SIZE)
+/* number of cubes in a chunk */
+#define CHUNK_CUBES (CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE)
+/* 64 bit words needed to hold one bit for each cube in a chunk */
+#define SURFACE_WORDS (CHUNK_CUBES / 64)
+/* index of chunk cx,cy,cz in worldChunk[] */
+#define chunkIndex(cx, cy, cz) (((cx) * CHUNKY + (cy)) * CHUNKZ + (cz))
+/* index of the bit for the cube at world position x,y,z in the surface */
+/* of its chunk, a row of cubes along z is CHUNK_SIZE bits in a row */
+#define surfaceIndex(x, y, z) ((((x) % CHUNK_SIZE) * CHUNK_SIZE + \
+   (y) % CHUNK_SIZE) * CHUNK_SIZE + (z) % CHUNK_SIZE)
+/* index of the cube at world position x,y,z inside its chunk, the cubes */
+/* are in x, y, z row order unless the program is built with */
+/* -DMORTON_LAYOUT which stores them in Morton (Z) order so that cubes */
+/* near each other along any axis are near each other in memory */
+#ifdef MORTON_LAYOUT
+#if CHUNK_SIZE != 16
+#error MORTON_LAYOUT needs a CHUNK_SIZE of 16
+#endif
+#define mortonSpread(v) (((v) & 1) | (((v) & 2) << 2) | (((v) & 4) << 4) | \
+   (((v) & 8) << 6))
+#define cubeIndex(x, y, z) ((mortonSpread((x) % CHUNK_SIZE) << 2) | \
+   (mortonSpread((y) % CHUNK_SIZE) << 1) | mortonSpread((z) % CHUNK_SIZE))
+#else
+#define cubeIndex(x, y, z) surfaceIndex(x, y, z)
+#endif
+
+/* the cubes in one chunk of the world, only chunks which contain at */
+/* least one cube are allocated, solid counts the non empty cubes and */
+/* surface has a bit set for each exposed cube at its surfaceIndex() */
+/* the cubes are stored as indexes into a palette of the colours used */
+/* in the chunk, each index is bits long where bits is 0, 1, 2, 4 or 8 */
+/* so an index never crosses a word, a chunk with bits 0 is filled */
+/* with palette[0], changed is set once a cube in the chunk is changed */
+typedef struct _WorldChunk {
+   int solid;
+   int changed;
+   unsigned long long surface[SURFACE_WORDS];
+   int bits;
+   int colours;
+   GLubyte palette[256];
+   unsigned int *index;
+} WorldChunk;
+
+/* the cube at cubeIndex() n in chunk c */
+#define chunkCube(c, n) ((c)->palette[((c)->index[((n) * (c)->bits) >> 5] \
+   >> (((n) * (c)->bits) & 31)) & ((1u << (c)->bits) - 1)])
+
+/* CHUNKX * CHUNKY * CHUNKZ chunks, NULL where the chunk is empty */
+extern WorldChunk **worldChunk;
+/* chunks of a world loaded from a file which have not been unpacked */
+/* yet, NULL once every chunk has been unpacked */
+extern unsigned char **worldStored;
+extern WorldChunk *touchWorldChunk(int);
+/* chunk n of the world, a chunk which is still in the world file is */
+/* unpacked the first time it is used */
+#define worldChunkAt(n) (((worldChunk[n] == NULL) && (worldStored != NULL)) ? \
+   touchWorldChunk(n) : worldChunk[n])
+/* number of cubes tested together by CubeBatchInFrustum() */
+#define FRUSTUM_BATCH 8
+/* floats per vertex in the chunk meshes and the instanced meshes, */
+/* normal followed by position (GL_N3F_V3F) */
+#define VERTEX_FLOATS 6
+/* occupancy of an octree node */
+#define OCTREE_EMPTY 0
+#define OCTREE_FULL 1
+#define OCTREE_MIXED 2
+
+/* octree node, counts of the non empty and exposed cubes inside it */
+/* children are indexes into octreeNode[], the root is node 0 so a */
+/* child index of 0 means the child has not been created, child n covers */
+/* the half of the parent with bit 0 of n selecting x, bit 1 y and bit 2 z */
+typedef struct _OctreeNode {
+   int solid;
+   int exposed;
+   int child[8];
+} OctreeNode;
 
 #define MAX_DISPLAY_LIST 500000
+/* display list entries pack a cube into 32 bits, the colour in the top */
+/* 4 bits followed by 10 bits of x, 8 bits of y and 10 bits of z */
+/* colours past the last one are drawn with the last colour */
+#define DISPLAY_COLOURS 9
+#define displayColour(c) (((c) < DISPLAY_COLOURS) ? (c) : DISPLAY_COLOURS - 1)
+#define packCube(x, y, z, c) (((unsigned int) displayColour(c) << 28) | \
+   ((unsigned int) (x) << 18) | ((unsigned int) (y) << 10) | (unsigned int) (z))
+#define cubeColour(e) ((e) >> 28)
+#define cubeX(e) (((e) >> 18) & 0x3ff)
+#define cubeY(e) (((e) >> 10) & 0xff)
+#define cubeZ(e) ((e) & 0x3ff)
+/* largest number of threads used by runJobs() */
+#define MAX_THREADS 64
+/* kinds of input event stored by -record, a key press, mouse movement */
+/* with no button and with a button held, the end of the recording */
+#define REPLAY_KEY 0
+#define REPLAY_LOOK 1
+#define REPLAY_DRAG 2
+#define REPLAY_END 3
+/* phases of a frame timed by the profiler, collision and walls are */
+/* timed inside update */
+#define PROFILE_FRUSTUM 0
+#define PROFILE_CULL 1
+#define PROFILE_MOBS 2
+#define PROFILE_CUBES 3
+#define PROFILE_UPDATE 4
+#define PROFILE_COLLISION 5
+#define PROFILE_WALLS 6
+#define PROFILE_PHASES 7
 
 typedef enum _WallState{
     open,
@@ -32,13 +149,6 @@ typedef struct _Wall{
     int x, z;
 } Wall;
 
-typedef struct _Pillar{
-    //Wall *north, *south, *east, *west;
-    //Pillar *pillar[4];
-
-    Wall *wall[4];
-} Pillar;
-
 typedef struct _GenerationInfo{
     float spawnChanceModifier;
     float spawnChance;
@@ -0,0 +1,247 @@
+/* Solid spans of each vertical column of the world, used to find the */
+/* ground under the viewpoint and whether there is room to stand */
+/* without reading the column one cube at a time. Each x,z column keeps */
+/* the runs of non empty cubes in it from the bottom up. The columns */
+/* are built a chunk column at a time the first time they are used, a */
+/* single changed cube edits the runs of its column and changes to */
+/* larger areas throw the columns away so they are built again. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics.h"
+
+	/* most runs kept for one column, a column with more is marked */
+	/* as COLUMN_OVERFLOW and is read one cube at a time instead */
+#define MAX_COLUMN_SPANS 8
+#define COLUMN_OVERFLOW -1
+	/* number of x,z columns in a chunk column */
+#define BLOCK_COLUMNS (CHUNK_SIZE * CHUNK_SIZE)
+
+extern GLubyte getWorldCube(int, int, int);
+extern void unpackWorldChunk(WorldChunk *, GLubyte *);
+
+	/* runs of non empty cubes in one column, run i covers the cubes */
+	/* from span[i][0] up to but not including span[i][1], the runs */
+	/* are in order from the bottom and never touch each other */
+typedef struct _Column {
+   short count;
+   short span[MAX_COLUMN_SPANS][2];
+} Column;
+
+	/* the columns of each chunk column, NULL until they are used */
+Column **columnBlock = NULL;
+
+/***********************/
+
+	/* add the cube at height y to the top of the runs in column */
+	/* the cubes must be added from the bottom up */
+void appendColumn(Column *column, int y) {
+   if (column->count == COLUMN_OVERFLOW)
+      return;
+   if ((column->count > 0) && (column->span[column->count - 1][1] == y)) {
+      column->span[column->count - 1][1] = y + 1;
+      return;
+   }
+   if (column->count == MAX_COLUMN_SPANS) {
+      column->count = COLUMN_OVERFLOW;
+      return;
+   }
+   column->span[column->count][0] = y;
+   column->span[column->count][1] = y + 1;
+   column->count++;
+}
+
+	/* build the columns of chunk column cx,cz from the chunks in it */
+Column *buildColumnBlock(int cx, int cz) {
+GLubyte cube[CHUNK_CUBES];
+WorldChunk *chunk;
+Column *block;
+int cy, x, y, z;
+
+   block = calloc(BLOCK_COLUMNS, sizeof(Column));
+   if (block == NULL) {
+      printf("ERROR: unable to allocate memory for the world columns\n");
+      exit(1);
+   }
+   for(cy=0; cy<CHUNKY; cy++) {
+      chunk = worldChunkAt(chunkIndex(cx, cy, cz));
+      if ((chunk == NULL) || (chunk->solid == 0))
+         continue;
+      unpackWorldChunk(chunk, cube);
+      for(x=0; x<CHUNK_SIZE; x++)
+         for(z=0; z<CHUNK_SIZE; z++)
+            for(y=0; (y<CHUNK_SIZE) && (cy*CHUNK_SIZE + y < WORLDY); y++)
+               if (cube[cubeIndex(x, y, z)] != 0)
+                  appendColumn(&block[x * CHUNK_SIZE + z], cy*CHUNK_SIZE + y);
+   }
+   return(block);
+}
+
+	/* returns the column at x,z which must be inside the world */
+Column *worldColumn(int x, int z) {
+Column **blocks, **none;
+Column *block, *empty;
+int n;
+
+	/* the mob jobs can get here on several threads at once, a thread */
+	/* which builds something another thread has already stored */
+	/* throws its own copy away */
+   blocks = __atomic_load_n(&columnBlock, __ATOMIC_ACQUIRE);
+   if (blocks == NULL) {
+      blocks = calloc(CHUNKX * CHUNKZ, sizeof(Column *));
+      if (blocks == NULL) {
+         printf("ERROR: unable to allocate memory for the world columns\n");
+         exit(1);
+      }
+      none = NULL;
+      if (!__atomic_compare_exchange_n(&columnBlock, &none, blocks, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+         free(blocks);
+         blocks = none;
+      }
+   }
+   n = (x / CHUNK_SIZE) * CHUNKZ + z / CHUNK_SIZE;
+   block = __atomic_load_n(&blocks[n], __ATOMIC_ACQUIRE);
+   if (block == NULL) {
+      block = buildColumnBlock(x / CHUNK_SIZE, z / CHUNK_SIZE);
+      empty = NULL;
+      if (!__atomic_compare_exchange_n(&blocks[n], &empty, block, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+         free(block);
+         block = empty;
+      }
+   }
+   return(&block[(x % CHUNK_SIZE) * CHUNK_SIZE + z % CHUNK_SIZE]);
+}
+
+	/* returns 1 if any cube from height by up to but not including ty */
+	/* in column x,z is not empty, cubes outside the world are empty */
+int columnSolid(int x, int z, int by, int ty) {
+Column *column;
+int i, y;
+
+   if ((x < 0) || (z < 0) || (x >= WORLDX) || (z >= WORLDZ))
+      return(0);
+   if (by < 0) by = 0;
+   if (ty > WORLDY) ty = WORLDY;
+   if (by >= ty)
+      return(0);
+   column = worldColumn(x, z);
+   if (column->count == COLUMN_OVERFLOW) {
+      for(y=by; y<ty; y++)
+         if (getWorldCube(x, y, z) != 0)
+            return(1);
+      return(0);
+   }
+   for(i=0; i<column->count; i++)
+      if ((column->span[i][0] < ty) && (column->span[i][1] > by))
+         return(1);
+   return(0);
+}
+
+	/* returns the height of the highest non empty cube at or below */
+	/* height y in column x,z, or -1 if there is none */
+int columnFloor(int x, int z, int y) {
+Column *column;
+int i;
+
+   if ((x < 0) || (z < 0) || (x >= WORLDX) || (z >= WORLDZ) || (y < 0))
+      return(-1);
+   if (y >= WORLDY)
+      y = WORLDY - 1;
+   column = worldColumn(x, z);
+   if (column->count == COLUMN_OVERFLOW) {
+      for(; y>=0; y--)
+         if (getWorldCube(x, y, z) != 0)
+            return(y);
+      return(-1);
+   }
+   for(i=column->count-1; i>=0; i--)
+      if (column->span[i][0] <= y)
+         return((column->span[i][1] <= y) ? column->span[i][1] - 1 : y);
+   return(-1);
+}
+
+	/* the cube at x,y,z changed from empty to not empty when solid is 1 */
+	/* or the other way when solid is 0, edit the runs of its column if */
+	/* it has been built */
+void updateColumn(int x, int y, int z, int solid) {
+Column *column;
+int i, n;
+
+   if ((columnBlock == NULL) ||
+       (columnBlock[(x / CHUNK_SIZE) * CHUNKZ + z / CHUNK_SIZE] == NULL))
+      return;
+   column = worldColumn(x, z);
+   if (column->count == COLUMN_OVERFLOW)
+      return;
+	/* first run which ends above y */
+   for(i=0; (i<column->count) && (column->span[i][1] <= y); i++)
+      ;
+   n = column->count;
+
+   if (solid == 1) {
+      if ((i < n) && (column->span[i][0] <= y))
+         return;
+		/* joins the run below, the run above or both */
+      if ((i > 0) && (column->span[i - 1][1] == y)) {
+         column->span[i - 1][1] = y + 1;
+         if ((i < n) && (column->span[i][0] == y + 1)) {
+            column->span[i - 1][1] = column->span[i][1];
+            memmove(&column->span[i], &column->span[i + 1],
+               sizeof(column->span[0]) * (n - i - 1));
+            column->count--;
+         }
+      } else if ((i < n) && (column->span[i][0] == y + 1))
+         column->span[i][0] = y;
+      else if (n == MAX_COLUMN_SPANS)
+         column->count = COLUMN_OVERFLOW;
+      else {
+         memmove(&column->span[i + 1], &column->span[i],
+            sizeof(column->span[0]) * (n - i));
+         column->span[i][0] = y;
+         column->span[i][1] = y + 1;
+         column->count++;
+      }
+   } else {
+      if ((i == n) || (column->span[i][0] > y))
+         return;
+      if (column->span[i][1] - column->span[i][0] == 1) {
+         memmove(&column->span[i], &column->span[i + 1],
+            sizeof(column->span[0]) * (n - i - 1));
+         column->count--;
+      } else if (column->span[i][0] == y)
+         column->span[i][0] = y + 1;
+      else if (column->span[i][1] == y + 1)
+         column->span[i][1] = y;
+		/* the run is split in two */
+      else if (n == MAX_COLUMN_SPANS)
+         column->count = COLUMN_OVERFLOW;
+      else {
+         memmove(&column->span[i + 1], &column->span[i],
+            sizeof(column->span[0]) * (n - i));
+         column->span[i][1] = y;
+         column->span[i + 1][0] = y + 1;
+         column->count++;
+      }
+   }
+}
+
+	/* throw away the columns from bx,bz up to but not including tx,tz */
+	/* after a larger change, they are built again when they are used */
+void invalidateColumns(int bx, int bz, int tx, int tz) {
+int cx, cz, n;
+
+   if (columnBlock == NULL)
+      return;
+   if (bx < 0) bx = 0;
+   if (bz < 0) bz = 0;
+   for(cx=bx/CHUNK_SIZE; (cx < CHUNKX) && (cx*CHUNK_SIZE < tx); cx++)
+      for(cz=bz/CHUNK_SIZE; (cz < CHUNKZ) && (cz*CHUNK_SIZE < tz); cz++) {
+         n = cx * CHUNKZ + cz;
+         free(columnBlock[n]);
+         columnBlock[n] = NULL;
+      }
+}
@@ -0,0 +1,372 @@
+/* Instanced drawing of the cubes in the display list, the mobs and the */
+/* players. One cube mesh and one sphere mesh are stored in vertex */
+/* buffers when the first frame is drawn and every copy of a mesh with */
+/* the same material is drawn with one call using a buffer of per */
+/* instance positions. A small shader repeats the fixed function */
+/* lighting so materials set with glMaterialfv() still apply. The */
+/* immediate mode drawing in display() is used when -immediate is given */
+/* or the extensions are not available. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "graphics.h"
+
+	/* generic attribute holding the centre and scale of an instance */
+	/* 6 is not shared with any of the fixed function attributes */
+#define INSTANCE_ATTRIB 6
+	/* tessellation of the sphere mesh, the same as the mob bodies */
+#define SPHERE_SLICES 8
+#define SPHERE_STACKS 8
+
+extern void setCubeMaterial(int);
+
+	/* flag which is set to 0 when immediate mode drawing is wanted */
+extern int instanced;
+	/* list of cubes to display grouped by colour */
+extern unsigned int displayList[MAX_DISPLAY_LIST];
+extern int displayFirst[DISPLAY_COLOURS];
+extern int displayColourCount[DISPLAY_COLOURS];
+
+	/* 0 before the first frame, 1 when instancing can be used and */
+	/* -1 when it is not supported */
+int instanceInit = 0;
+
+GLuint instanceProgram = 0;
+GLuint cubeBuffer = 0, sphereBuffer = 0, instanceBuffer = 0;
+int cubeVertices = 0, sphereVertices = 0;
+
+	/* centre and scale of each instance, copied to instanceBuffer */
+GLfloat *instanceData = NULL;
+int instanceSize = 0;
+
+	/* per vertex lighting for lights 0 and 1 following the fixed */
+	/* function equations with a local viewer */
+char *instanceVertexShader =
+   "#version 120\n"
+   "attribute vec4 instance;\n"
+   "vec4 light(int i, vec3 n, vec3 p) {\n"
+   "   vec3 l, h;\n"
+   "   float atten, d, nl;\n"
+   "   vec4 c;\n"
+   "   if (gl_LightSource[i].position.w == 0.0) {\n"
+   "      l = normalize(gl_LightSource[i].position.xyz);\n"
+   "      atten = 1.0;\n"
+   "   } else {\n"
+   "      l = gl_LightSource[i].position.xyz - p;\n"
+   "      d = length(l);\n"
+   "      l /= d;\n"
+   "      atten = 1.0 / (gl_LightSource[i].constantAttenuation\n"
+   "         + gl_LightSource[i].linearAttenuation * d\n"
+   "         + gl_LightSource[i].quadraticAttenuation * d * d);\n"
+   "   }\n"
+   "   nl = dot(n, l);\n"
+   "   c = gl_FrontLightProduct[i].ambient\n"
+   "      + max(nl, 0.0) * gl_FrontLightProduct[i].diffuse;\n"
+   "   if (nl > 0.0) {\n"
+   "      h = normalize(l + normalize(-p));\n"
+   "      c += pow(max(dot(n, h), 0.0), gl_FrontMaterial.shininess)\n"
+   "         * gl_FrontLightProduct[i].specular;\n"
+   "   }\n"
+   "   return(atten * c);\n"
+   "}\n"
+   "void main() {\n"
+   "   vec4 v;\n"
+   "   vec3 n, p;\n"
+   "   v = vec4(gl_Vertex.xyz * instance.w + instance.xyz, 1.0);\n"
+   "   p = (gl_ModelViewMatrix * v).xyz;\n"
+   "   n = normalize(gl_NormalMatrix * gl_Normal);\n"
+   "   gl_FrontColor = gl_FrontLightModelProduct.sceneColor\n"
+   "      + light(0, n, p) + light(1, n, p);\n"
+   "   gl_FrontColor.a = gl_FrontMaterial.diffuse.a;\n"
+   "   gl_Position = gl_ModelViewProjectionMatrix * v;\n"
+   "}\n";
+
+char *instanceFragmentShader =
+   "#version 120\n"
+   "void main() {\n"
+   "   gl_FragColor = gl_Color;\n"
+   "}\n";
+
+/***********************/
+
+	/* returns 1 if the named extension is supported */
+int hasExtension(char *name) {
+const char *list, *found;
+int length;
+
+   list = (const char *) glGetString(GL_EXTENSIONS);
+   if (list == NULL)
+      return(0);
+   length = strlen(name);
+   for(found=strstr(list, name); found!=NULL; found=strstr(found+1, name))
+      if (((found == list) || (found[-1] == ' ')) &&
+          ((found[length] == ' ') || (found[length] == '\0')))
+         return(1);
+   return(0);
+}
+
+	/* compile a shader, returns 0 and prints the log if it fails */
+GLuint compileShader(GLenum type, char *source) {
+GLuint shader;
+GLint status;
+char log[1024];
+
+   shader = glCreateShader(type);
+   glShaderSource(shader, 1, (const GLchar **) &source, NULL);
+   glCompileShader(shader);
+   glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+   if (status == GL_FALSE) {
+      glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+      printf("instanced drawing shader failed to compile:\n%s\n", log);
+      glDeleteShader(shader);
+      return(0);
+   }
+   return(shader);
+}
+
+	/* add the vertex at unit sphere angles phi,theta to a mesh, the */
+	/* normal and the position are the same */
+GLfloat *sphereVertex(GLfloat *p, float phi, float theta) {
+   p[0] = sinf(phi) * cosf(theta);
+   p[1] = sinf(phi) * sinf(theta);
+   p[2] = cosf(phi);
+   p[3] = p[0];  p[4] = p[1];  p[5] = p[2];
+   return(p + VERTEX_FLOATS);
+}
+
+	/* store a mesh in a new vertex buffer */
+GLuint uploadMesh(GLfloat *vertex, int count) {
+GLuint buffer;
+
+   glGenBuffers(1, &buffer);
+   glBindBuffer(GL_ARRAY_BUFFER, buffer);
+   glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * VERTEX_FLOATS * count,
+      vertex, GL_STATIC_DRAW);
+   return(buffer);
+}
+
+	/* build the unit cube and the unit radius sphere meshes as */
+	/* triangles, counter clockwise when seen from outside */
+void buildInstanceMeshes() {
+	/* corners of each face counter clockwise from outside */
+static int face[6][4][3] = {
+   {{1,0,0}, {1,1,0}, {1,1,1}, {1,0,1}},
+   {{0,0,0}, {0,0,1}, {0,1,1}, {0,1,0}},
+   {{0,1,0}, {0,1,1}, {1,1,1}, {1,1,0}},
+   {{0,0,0}, {1,0,0}, {1,0,1}, {0,0,1}},
+   {{0,0,1}, {1,0,1}, {1,1,1}, {0,1,1}},
+   {{0,0,0}, {0,1,0}, {1,1,0}, {1,0,0}} };
+static float normal[6][3] = {
+   {1,0,0}, {-1,0,0}, {0,1,0}, {0,-1,0}, {0,0,1}, {0,0,-1} };
+static int corner[6] = {0, 1, 2, 0, 2, 3};
+GLfloat cube[36 * VERTEX_FLOATS];
+GLfloat sphere[SPHERE_STACKS * SPHERE_SLICES * 6 * VERTEX_FLOATS];
+GLfloat *p;
+float phi0, phi1, theta0, theta1;
+int f, c, i, j;
+
+   p = cube;
+   for(f=0; f<6; f++)
+      for(c=0; c<6; c++) {
+         p[0] = normal[f][0];  p[1] = normal[f][1];  p[2] = normal[f][2];
+         p[3] = face[f][corner[c]][0] - 0.5;
+         p[4] = face[f][corner[c]][1] - 0.5;
+         p[5] = face[f][corner[c]][2] - 0.5;
+         p += VERTEX_FLOATS;
+      }
+   cubeVertices = 36;
+   cubeBuffer = uploadMesh(cube, cubeVertices);
+
+	/* stacks run from +z to -z and slices around z like glutSolidSphere */
+   p = sphere;
+   for(i=0; i<SPHERE_STACKS; i++) {
+      phi0 = M_PI * i / SPHERE_STACKS;
+      phi1 = M_PI * (i + 1) / SPHERE_STACKS;
+      for(j=0; j<SPHERE_SLICES; j++) {
+         theta0 = 2.0 * M_PI * j / SPHERE_SLICES;
+         theta1 = 2.0 * M_PI * (j + 1) / SPHERE_SLICES;
+         p = sphereVertex(p, phi0, theta0);
+         p = sphereVertex(p, phi1, theta0);
+         p = sphereVertex(p, phi1, theta1);
+         p = sphereVertex(p, phi0, theta0);
+         p = sphereVertex(p, phi1, theta1);
+         p = sphereVertex(p, phi0, theta1);
+      }
+   }
+   sphereVertices = SPHERE_STACKS * SPHERE_SLICES * 6;
+   sphereBuffer = uploadMesh(sphere, sphereVertices);
+
+   glGenBuffers(1, &instanceBuffer);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+	/* check the extensions, build the shader and upload the meshes */
+	/* the first time something is drawn, returns 1 if instancing */
+	/* can be used */
+int initInstancing() {
+GLuint vertex, fragment;
+GLint status;
+
+   if (instanceInit != 0)
+      return(instanceInit == 1);
+   instanceInit = -1;
+
+   if ((hasExtension("GL_ARB_instanced_arrays") == 0) ||
+       (hasExtension("GL_ARB_draw_instanced") == 0) ||
+       (hasExtension("GL_ARB_vertex_buffer_object") == 0)) {
+      printf("instanced drawing is not supported, using immediate mode\n");
+      return(0);
+   }
+
+   vertex = compileShader(GL_VERTEX_SHADER, instanceVertexShader);
+   fragment = compileShader(GL_FRAGMENT_SHADER, instanceFragmentShader);
+   if ((vertex == 0) || (fragment == 0)) {
+      printf("using immediate mode drawing\n");
+      return(0);
+   }
+   instanceProgram = glCreateProgram();
+   glAttachShader(instanceProgram, vertex);
+   glAttachShader(instanceProgram, fragment);
+   glBindAttribLocation(instanceProgram, INSTANCE_ATTRIB, "instance");
+   glLinkProgram(instanceProgram);
+   glGetProgramiv(instanceProgram, GL_LINK_STATUS, &status);
+   if (status == GL_FALSE) {
+      printf("instanced drawing shader failed to link, using immediate mode\n");
+      return(0);
+   }
+
+   buildInstanceMeshes();
+   instanceInit = 1;
+   return(1);
+}
+
+	/* make room for count instances in instanceData[] */
+void growInstances(int count) {
+   if (count <= instanceSize)
+      return;
+   while (instanceSize < count)
+      instanceSize = (instanceSize == 0) ? 1024 : instanceSize * 2;
+   instanceData = realloc(instanceData, sizeof(GLfloat) * 4 * instanceSize);
+   if (instanceData == NULL) {
+      printf("ERROR: unable to allocate memory for instances\n");
+      exit(1);
+   }
+}
+
+	/* set the centre and scale of instance n */
+void setInstance(int n, float x, float y, float z, float scale) {
+   instanceData[n * 4] = x;
+   instanceData[n * 4 + 1] = y;
+   instanceData[n * 4 + 2] = z;
+   instanceData[n * 4 + 3] = scale;
+}
+
+	/* copy count instances to instanceBuffer */
+void uploadInstances(int count) {
+   glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+   glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 4 * count, instanceData,
+      GL_STREAM_DRAW);
+}
+
+	/* draw count copies of a mesh using the instances in instanceBuffer */
+	/* starting at instance first with the current material */
+void drawInstances(GLuint mesh, int vertices, int first, int count) {
+   if (count == 0)
+      return;
+   glBindBuffer(GL_ARRAY_BUFFER, mesh);
+   glInterleavedArrays(GL_N3F_V3F, 0, NULL);
+   glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+   glVertexAttribPointer(INSTANCE_ATTRIB, 4, GL_FLOAT, GL_FALSE, 0,
+      (GLvoid *) (sizeof(GLfloat) * 4 * first));
+   glEnableVertexAttribArray(INSTANCE_ATTRIB);
+   glVertexAttribDivisorARB(INSTANCE_ATTRIB, 1);
+   glDrawArraysInstancedARB(GL_TRIANGLES, 0, vertices, count);
+}
+
+	/* turn off the state used for instanced drawing */
+void endInstances() {
+   glDisableVertexAttribArray(INSTANCE_ATTRIB);
+   glDisableClientState(GL_VERTEX_ARRAY);
+   glDisableClientState(GL_NORMAL_ARRAY);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   glUseProgram(0);
+}
+
+	/* draw the cubes in the display list, the material for each */
+	/* colour is set once and all of the cubes of that colour are drawn */
+	/* with one call, returns 0 if immediate mode must be used instead */
+int drawInstancedCubes(int count) {
+int i, c;
+
+   if ((instanced == 0) || (initInstancing() == 0))
+      return(0);
+
+   growInstances(count);
+   for(i=0; i<count; i++)
+      setInstance(i, cubeX(displayList[i]) + 0.5, cubeY(displayList[i]) + 0.5,
+         cubeZ(displayList[i]) + 0.5, 1.0);
+   glUseProgram(instanceProgram);
+   uploadInstances(count);
+   for(c=1; c<DISPLAY_COLOURS; c++) {
+      if (displayColourCount[c] == 0)
+         continue;
+      setCubeMaterial(c);
+      drawInstances(cubeBuffer, cubeVertices, displayFirst[c],
+         displayColourCount[c]);
+   }
+   endInstances();
+   return(1);
+}
+
+	/* draw the mobs or players, all of the bodies are drawn with one */
+	/* call and then all of the eyes, the eyes are placed the same way */
+	/* as the immediate mode code, returns 0 if immediate mode must be */
+	/* used instead, a NULL visible draws all count of them */
+int drawInstancedCreatures(float position[][4], short visible[], int count,
+   GLfloat *bodyAmbient, GLfloat *bodyDiffuse, GLfloat *eyeColour) {
+int i, n;
+float x, y, z, angle;
+
+   if ((instanced == 0) || (initInstancing() == 0))
+      return(0);
+
+	/* bodies are instances 0 to n-1 and eyes are n to 3n-1 */
+   n = 0;
+   for(i=0; i<count; i++)
+      if ((visible == NULL) || (visible[i] == 1))
+         n++;
+   if (n == 0)
+      return(1);
+   growInstances(n * 3);
+   n = 0;
+   for(i=0; i<count; i++)
+      if ((visible == NULL) || (visible[i] == 1))
+         setInstance(n++, position[i][0] + 0.5, position[i][1] + 0.5,
+            position[i][2] + 0.5, 0.5);
+   for(i=0; i<count; i++)
+      if ((visible == NULL) || (visible[i] == 1)) {
+         x = position[i][0] + 0.5;
+         y = position[i][1] + 0.6;
+         z = position[i][2] + 0.5;
+         angle = position[i][3] / 180.0 * M_PI;
+		/* eyes at (0.3, 0.1, 0.3) and (-0.3, 0.1, 0.3) rotated */
+		/* about y by the angle of the body */
+         setInstance(n++, x + 0.3 * cosf(angle) + 0.3 * sinf(angle), y,
+            z - 0.3 * sinf(angle) + 0.3 * cosf(angle), 0.1);
+         setInstance(n++, x - 0.3 * cosf(angle) + 0.3 * sinf(angle), y,
+            z + 0.3 * sinf(angle) + 0.3 * cosf(angle), 0.1);
+      }
+
+   glUseProgram(instanceProgram);
+   uploadInstances(n);
+   glMaterialfv(GL_FRONT, GL_AMBIENT, bodyAmbient);
+   glMaterialfv(GL_FRONT, GL_DIFFUSE, bodyDiffuse);
+   drawInstances(sphereBuffer, sphereVertices, 0, n / 3);
+   glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, eyeColour);
+   drawInstances(sphereBuffer, sphereVertices, n / 3, n - n / 3);
+   endInstances();
+   return(1);
+}
@@ -0,0 +1,137 @@
+/* Small pool of worker threads used to run independent jobs in parallel. */
+/* runJobs() splits the jobs into one queue per thread and every thread, */
+/* including the caller, takes jobs from its own queue first and then */
+/* steals from the queues of the other threads until all are done. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "graphics.h"
+
+	/* jobs from first up to but not including last belong to a thread */
+	/* next is the next job to take and is shared with thieves */
+typedef struct _JobQueue {
+   int next;
+   int last;
+} JobQueue;
+
+	/* number of threads used by runJobs(), including the caller */
+int jobThreads = 1;
+
+pthread_t jobThread[MAX_THREADS];
+pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t jobStart = PTHREAD_COND_INITIALIZER;
+pthread_cond_t jobDone = PTHREAD_COND_INITIALIZER;
+	/* incremented each time runJobs() hands out new work */
+int jobGeneration = 0;
+	/* number of worker threads which have finished the current work */
+int jobFinished = 0;
+	/* number of worker threads which have been started */
+int jobWorkers = 0;
+
+JobQueue jobQueue[MAX_THREADS];
+void (*jobFunction)(int, int) = NULL;
+
+/***********************/
+
+	/* take a job from the queue of thread q, returns -1 if it is empty */
+int takeJob(int q) {
+int job;
+
+   if (__atomic_load_n(&jobQueue[q].next, __ATOMIC_RELAXED) >= jobQueue[q].last)
+      return(-1);
+   job = __atomic_fetch_add(&jobQueue[q].next, 1, __ATOMIC_RELAXED);
+   if (job >= jobQueue[q].last)
+      return(-1);
+   return(job);
+}
+
+	/* run jobs as thread t until every queue is empty */
+void workJobs(int t) {
+int q, job;
+
+   for(q=0; q<jobThreads; q++)
+      while ((job = takeJob((t + q) % jobThreads)) != -1)
+         jobFunction(job, t);
+}
+
+	/* worker threads wait for runJobs() to hand out work */
+void *jobWorker(void *arg) {
+int t, seen;
+
+   t = (int) (long) arg;
+   seen = 0;
+   while (1) {
+      pthread_mutex_lock(&jobLock);
+      while (jobGeneration == seen)
+         pthread_cond_wait(&jobStart, &jobLock);
+      seen = jobGeneration;
+      pthread_mutex_unlock(&jobLock);
+
+		/* workers left over after the thread count was lowered idle */
+      if (t >= jobThreads)
+         continue;
+      workJobs(t);
+
+      pthread_mutex_lock(&jobLock);
+      jobFinished++;
+      if (jobFinished == jobThreads - 1)
+         pthread_cond_signal(&jobDone);
+      pthread_mutex_unlock(&jobLock);
+   }
+   return(NULL);
+}
+
+	/* set the number of threads used by runJobs(), the worker threads */
+	/* are started the first time they are needed */
+void setJobThreads(int threads) {
+   if (threads < 1)
+      threads = 1;
+   if (threads > MAX_THREADS)
+      threads = MAX_THREADS;
+   jobThreads = threads;
+}
+
+	/* call function(job, thread) for job = 0 to count-1 using jobThreads */
+	/* threads, thread is the number of the thread running the job and */
+	/* the call returns when every job has finished */
+void runJobs(int count, void (*function)(int, int)) {
+int t;
+
+   if ((jobThreads == 1) || (count <= 1)) {
+      for(t=0; t<count; t++)
+         function(t, 0);
+      return;
+   }
+
+   while (jobWorkers < jobThreads - 1) {
+      if (pthread_create(&jobThread[jobWorkers + 1], NULL, jobWorker,
+            (void *) (long) (jobWorkers + 1)) != 0) {
+         printf("ERROR: unable to create worker thread\n");
+         exit(1);
+      }
+      jobWorkers++;
+   }
+
+	/* give each thread an equal share of the jobs */
+   jobFunction = function;
+   for(t=0; t<jobThreads; t++) {
+      jobQueue[t].next = (count * t) / jobThreads;
+      jobQueue[t].last = (count * (t + 1)) / jobThreads;
+   }
+
+   pthread_mutex_lock(&jobLock);
+   jobFinished = 0;
+   jobGeneration++;
+   pthread_cond_broadcast(&jobStart);
+   pthread_mutex_unlock(&jobLock);
+
+   workJobs(0);
+
+   pthread_mutex_lock(&jobLock);
+   while (jobFinished < jobThreads - 1)
+      pthread_cond_wait(&jobDone, &jobLock);
+   pthread_mutex_unlock(&jobLock);
+}
@@ -0,0 +1,306 @@
+/* Chunk geometry cache. The world is divided into CHUNK_SIZE cubed chunks. */
+/* The exposed faces in each chunk are greedily merged into quads which */
+/* are kept in a vertex buffer and only rebuilt when the chunk changes. */
+/* Changes are reported through dirtyChunkMesh() by flushWorldDirty(). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "graphics.h"
+
+	/* colour ids 1 to 8 are drawn, 0 is empty */
+#define MESH_COLOURS 9
+
+extern int CubeInFrustum(float, float, float, float);
+extern GLubyte getWorldCube(int, int, int);
+extern void unpackWorldChunk(WorldChunk *, GLubyte *);
+extern int boxOccluded(float, float, float, float, float, float);
+extern void setCubeMaterial(int);
+
+typedef struct _ChunkMesh {
+	/* quads sorted by colour, 4 vertices per quad */
+   GLfloat *vertex;
+   int vertexSize;
+   int quads;
+	/* first vertex and number of vertices for each colour */
+   int first[MESH_COLOURS];
+   int count[MESH_COLOURS];
+	/* vertex buffer, uploaded is 0 when the geometry has changed */
+   GLuint buffer;
+   int uploaded;
+	/* set to 1 when the chunk contents have changed */
+   int dirty;
+   int visible;
+} ChunkMesh;
+
+ChunkMesh *chunkMesh = NULL;
+int chunkMeshInit = 0;
+
+	/* number of chunks and quads which passed the last culling pass */
+	/* and the number of chunks hidden by occluders */
+int meshChunkCount = 0;
+int meshQuadCount = 0;
+int meshOccludedCount = 0;
+
+	/* quads for the chunk being built, one list per colour */
+GLfloat *scratch[MESH_COLOURS];
+int scratchCount[MESH_COLOURS];
+int scratchSize[MESH_COLOURS];
+
+/***********************/
+
+	/* returns the cube at x,y,z or 0 if it is outside the world */
+int meshCell(int x, int y, int z) {
+   return(getWorldCube(x, y, z));
+}
+
+	/* grows a vertex array so it can hold at least count vertices */
+GLfloat *growVertices(GLfloat *vertex, int *size, int count) {
+   if (count <= *size)
+      return(vertex);
+   while (*size < count)
+      *size = (*size == 0) ? 256 : *size * 2;
+   vertex = realloc(vertex, sizeof(GLfloat) * VERTEX_FLOATS * (*size));
+   if (vertex == NULL) {
+      printf("ERROR: unable to allocate memory for chunk geometry\n");
+      exit(1);
+   }
+   return(vertex);
+}
+
+	/* add a quad to the scratch list for its colour, the quad lies */
+	/* in the plane position[d] = plane and covers w by h cubes along */
+	/* the axes u and v, dir is the direction the face points along d */
+void addQuad(int colour, int d, int dir, int plane, int u0, int v0,
+   int w, int h) {
+int u, v, i, c;
+int corner[4][2];
+GLfloat *p;
+
+   u = (d + 1) % 3;
+   v = (d + 2) % 3;
+	/* counter clockwise when seen from the direction the face points */
+   corner[0][0] = u0;      corner[0][1] = v0;
+   corner[1][0] = u0 + w;  corner[1][1] = v0;
+   corner[2][0] = u0 + w;  corner[2][1] = v0 + h;
+   corner[3][0] = u0;      corner[3][1] = v0 + h;
+
+   scratch[colour] = growVertices(scratch[colour], &scratchSize[colour],
+      scratchCount[colour] + 4);
+   p = &scratch[colour][scratchCount[colour] * VERTEX_FLOATS];
+   for(i=0; i<4; i++) {
+      c = (dir > 0) ? i : 3 - i;
+      p[0] = 0.0;  p[1] = 0.0;  p[2] = 0.0;
+      p[d] = (GLfloat) dir;
+      p[3 + d] = (GLfloat) plane;
+      p[3 + u] = (GLfloat) corner[c][0];
+      p[3 + v] = (GLfloat) corner[c][1];
+      p += VERTEX_FLOATS;
+   }
+   scratchCount[colour] += 4;
+}
+
+	/* rebuild the quads for chunk cx,cy,cz using greedy meshing */
+	/* each slice of the chunk is turned into a mask of exposed faces */
+	/* and neighbouring faces of the same colour are merged */
+void buildChunkMesh(int cx, int cy, int cz) {
+ChunkMesh *chunk;
+WorldChunk *cubes;
+GLubyte cell[CHUNK_CUBES];
+GLubyte mask[CHUNK_SIZE][CHUNK_SIZE];
+int base[3], size[3], pos[3];
+int d, u, v, dir, s, i, j, w, h, k, colour, total;
+
+   chunk = &chunkMesh[chunkIndex(cx, cy, cz)];
+   base[0] = cx * CHUNK_SIZE;
+   base[1] = cy * CHUNK_SIZE;
+   base[2] = cz * CHUNK_SIZE;
+   size[0] = (WORLDX - base[0] < CHUNK_SIZE) ? WORLDX - base[0] : CHUNK_SIZE;
+   size[1] = (WORLDY - base[1] < CHUNK_SIZE) ? WORLDY - base[1] : CHUNK_SIZE;
+   size[2] = (WORLDZ - base[2] < CHUNK_SIZE) ? WORLDZ - base[2] : CHUNK_SIZE;
+
+   for(colour=0; colour<MESH_COLOURS; colour++)
+      scratchCount[colour] = 0;
+
+	/* a chunk which is not allocated has no cubes and no faces */
+   cubes = worldChunkAt(chunkIndex(cx, cy, cz));
+   if (cubes == NULL) {
+      for(colour=0; colour<MESH_COLOURS; colour++)
+         chunk->count[colour] = 0;
+      chunk->quads = 0;
+      chunk->uploaded = 0;
+      return;
+   }
+	/* the packed cubes are unpacked once for the whole chunk */
+   unpackWorldChunk(cubes, cell);
+
+   for(d=0; d<3; d++) {
+      u = (d + 1) % 3;
+      v = (d + 2) % 3;
+      for(dir=-1; dir<=1; dir+=2) {
+         for(s=0; s<size[d]; s++) {
+		/* find the exposed faces in this slice */
+            pos[d] = base[d] + s;
+            for(i=0; i<size[u]; i++)
+               for(j=0; j<size[v]; j++) {
+                  pos[u] = base[u] + i;
+                  pos[v] = base[v] + j;
+                  colour = cell[cubeIndex(pos[0], pos[1], pos[2])];
+                  if (colour != 0) {
+		/* only the neighbours across the edge are in another chunk */
+                     pos[d] += dir;
+                     if ((s + dir >= 0) && (s + dir < CHUNK_SIZE)) {
+                        if (cell[cubeIndex(pos[0], pos[1], pos[2])] != 0)
+                           colour = 0;
+                     } else if (meshCell(pos[0], pos[1], pos[2]) != 0)
+                        colour = 0;
+                     pos[d] -= dir;
+                  }
+                  if (colour >= MESH_COLOURS)
+                     colour = MESH_COLOURS - 1;
+                  mask[i][j] = colour;
+               }
+
+		/* merge the faces into as few quads as possible */
+            for(i=0; i<size[u]; i++)
+               for(j=0; j<size[v]; ) {
+                  colour = mask[i][j];
+                  if (colour == 0) {
+                     j++;
+                     continue;
+                  }
+                  for(h=1; (j+h < size[v]) && (mask[i][j+h] == colour); h++);
+                  for(w=1; i+w < size[u]; w++) {
+                     for(k=0; (k < h) && (mask[i+w][j+k] == colour); k++);
+                     if (k < h)
+                        break;
+                  }
+                  addQuad(colour, d, dir, base[d] + s + ((dir > 0) ? 1 : 0),
+                     base[u] + i, base[v] + j, w, h);
+                  for(k=0; k<w; k++)
+                     memset(&mask[i+k][j], 0, h);
+                  j += h;
+               }
+         }
+      }
+   }
+
+	/* store the quads in the chunk sorted by colour */
+   total = 0;
+   for(colour=0; colour<MESH_COLOURS; colour++)
+      total += scratchCount[colour];
+   chunk->vertex = growVertices(chunk->vertex, &chunk->vertexSize, total);
+   total = 0;
+   for(colour=0; colour<MESH_COLOURS; colour++) {
+      chunk->first[colour] = total;
+      chunk->count[colour] = scratchCount[colour];
+      if (scratchCount[colour] > 0)
+         memcpy(&chunk->vertex[total * VERTEX_FLOATS], scratch[colour],
+            sizeof(GLfloat) * VERTEX_FLOATS * scratchCount[colour]);
+      total += scratchCount[colour];
+   }
+   chunk->quads = total / 4;
+   chunk->uploaded = 0;
+}
+
+	/* the contents of chunk cx,cy,cz changed, rebuild its geometry */
+	/* the next time updateChunkMeshes() is called */
+void dirtyChunkMesh(int cx, int cy, int cz) {
+   if (chunkMesh != NULL)
+      chunkMesh[chunkIndex(cx, cy, cz)].dirty = 1;
+}
+
+	/* rebuild the geometry of the chunks which have changed, all of */
+	/* the chunks are built the first time this is called */
+void updateChunkMeshes() {
+int x, y, z;
+
+   if (chunkMeshInit == 0) {
+      chunkMesh = calloc(CHUNKX * CHUNKY * CHUNKZ, sizeof(ChunkMesh));
+      if (chunkMesh == NULL) {
+         printf("ERROR: unable to allocate memory for chunk geometry\n");
+         exit(1);
+      }
+      for(x=0; x<CHUNKX; x++)
+         for(y=0; y<CHUNKY; y++)
+            for(z=0; z<CHUNKZ; z++)
+               chunkMesh[chunkIndex(x, y, z)].dirty = 1;
+      chunkMeshInit = 1;
+   }
+
+   for(x=0; x<CHUNKX; x++)
+      for(y=0; y<CHUNKY; y++)
+         for(z=0; z<CHUNKZ; z++)
+            if (chunkMesh[chunkIndex(x, y, z)].dirty == 1) {
+               buildChunkMesh(x, y, z);
+               chunkMesh[chunkIndex(x, y, z)].dirty = 0;
+            }
+}
+
+	/* mark the chunks which are inside the viewing frustum */
+	/* uses frustum[][] so ExtractFrustum() must be called first */
+void cullChunkMeshes() {
+int x, y, z;
+float half = CHUNK_SIZE / 2.0;
+ChunkMesh *chunk;
+
+   meshChunkCount = 0;
+   meshQuadCount = 0;
+   meshOccludedCount = 0;
+   for(x=0; x<CHUNKX; x++)
+      for(y=0; y<CHUNKY; y++)
+         for(z=0; z<CHUNKZ; z++) {
+            chunk = &chunkMesh[chunkIndex(x, y, z)];
+            chunk->visible = 0;
+            if ((chunk->quads > 0) &&
+                (CubeInFrustum(x * CHUNK_SIZE + half, y * CHUNK_SIZE + half,
+                   z * CHUNK_SIZE + half, half) != 0)) {
+               if (boxOccluded(x * CHUNK_SIZE, y * CHUNK_SIZE, z * CHUNK_SIZE,
+                     (x + 1) * CHUNK_SIZE, (y + 1) * CHUNK_SIZE,
+                     (z + 1) * CHUNK_SIZE) == 1) {
+                  meshOccludedCount++;
+                  continue;
+               }
+               chunk->visible = 1;
+               meshChunkCount++;
+               meshQuadCount += chunk->quads;
+            }
+         }
+}
+
+	/* draw the visible chunks, the material for each colour is set */
+	/* once and then every visible chunk with that colour is drawn */
+void drawChunkMeshes() {
+int x, y, z, colour;
+ChunkMesh *chunk;
+
+   for(colour=1; colour<MESH_COLOURS; colour++) {
+      setCubeMaterial(colour);
+      for(x=0; x<CHUNKX; x++)
+         for(y=0; y<CHUNKY; y++)
+            for(z=0; z<CHUNKZ; z++) {
+               chunk = &chunkMesh[chunkIndex(x, y, z)];
+               if ((chunk->visible == 0) || (chunk->count[colour] == 0))
+                  continue;
+		/* copy new geometry to the vertex buffer */
+               if (chunk->uploaded == 0) {
+                  if (chunk->buffer == 0)
+                     glGenBuffers(1, &chunk->buffer);
+                  glBindBuffer(GL_ARRAY_BUFFER, chunk->buffer);
+                  glBufferData(GL_ARRAY_BUFFER,
+                     sizeof(GLfloat) * VERTEX_FLOATS * chunk->quads * 4,
+                     chunk->vertex, GL_STATIC_DRAW);
+                  chunk->uploaded = 1;
+               } else
+                  glBindBuffer(GL_ARRAY_BUFFER, chunk->buffer);
+               glInterleavedArrays(GL_N3F_V3F, 0, NULL);
+               glDrawArrays(GL_QUADS, chunk->first[colour],
+                  chunk->count[colour]);
+            }
+   }
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   glDisableClientState(GL_VERTEX_ARRAY);
+   glDisableClientState(GL_NORMAL_ARRAY);
+}
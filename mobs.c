@@ -0,0 +1,444 @@
+/* Storage and simulation of the mobs. Each value of a mob is kept in */
+/* its own array, a structure of arrays, so the loops over thousands */
+/* of mobs read memory in order and the frustum test can take eight */
+/* mobs at a time. The arrays grow as mobs with higher numbers are */
+/* created. A uniform spatial hash of the mobs is rebuilt by hashMobs() */
+/* once a tick and answers which mobs are near a point. stepMobs() moves */
+/* the walking mobs on the job threads, each job reads the positions */
+/* from the start of the tick and writes the new ones into a second */
+/* set of arrays which are swapped in when every job has finished. */
+/* Seeking mobs walk down the flow field in flow.c towards its target. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "graphics.h"
+
+	/* size of a spatial hash cell in cubes and the number of buckets */
+	/* which must be a power of two */
+#define MOB_CELL 2
+#define MOB_BUCKETS 16384
+	/* size of the box a mob fills when it moves through the world */
+#define MOB_WIDTH 0.8
+#define MOB_HEIGHT 1.0
+	/* mobs closer than this push each other apart */
+#define MOB_SPACING 1.0
+#define MOB_PUSH 0.02
+	/* added to the speed of a falling mob each tick */
+#define MOB_GRAVITY 0.05
+	/* most neighbours looked at for each mob each tick */
+#define MOB_NEIGHBOURS 16
+	/* mobs moved by each job of stepMobs() */
+#define MOB_JOB 256
+	/* speed of a seeking mob in cubes per tick */
+#define MOB_SEEK_SPEED 0.1
+	/* how each mob is moved, by the caller with setMobPosition(), at */
+	/* the speed given to setMobSpeed() or down the flow field */
+#define MOB_PLACED 0
+#define MOB_WALKING 1
+#define MOB_SEEKING 2
+
+extern unsigned int CubeBatchInFrustum(float *, float *, float *, float);
+extern int sweepBox(float [6], float [3]);
+extern float blendAngle(float, float, float);
+extern void runJobs(int, void (*)(int, int));
+extern void updateFlowField();
+extern int flowDirection(float, float, float *, float *);
+
+	/* one more than the highest mob number used and the number of */
+	/* mobs the arrays have room for, a multiple of FRUSTUM_BATCH */
+int mobCount = 0;
+int mobCapacity = 0;
+	/* position of each mob and its rotation about y */
+float *mobX = NULL, *mobY = NULL, *mobZ = NULL, *mobAngle = NULL;
+	/* position and rotation before the last tick */
+float *mobLastX = NULL, *mobLastY = NULL, *mobLastZ = NULL;
+float *mobLastAngle = NULL;
+	/* position and rotation after the tick being stepped */
+float *mobNextX = NULL, *mobNextY = NULL, *mobNextZ = NULL;
+float *mobNextAngle = NULL;
+	/* speed in cubes per tick used by stepMobs() */
+float *mobSpeedX = NULL, *mobSpeedY = NULL, *mobSpeedZ = NULL;
+	/* 1 when the mob is drawn */
+unsigned char *mobShown = NULL;
+	/* MOB_PLACED, MOB_WALKING or MOB_SEEKING */
+unsigned char *mobWalking = NULL;
+	/* number of mobs set to MOB_SEEKING, the flow field is only */
+	/* brought up to date while there are any */
+int mobSeekCount = 0;
+
+	/* mobs found inside the frustum by cullMobs() and the positions */
+	/* they are drawn at */
+int *mobDrawList = NULL;
+int mobDrawCount = 0;
+float (*mobDrawn)[4] = NULL;
+
+	/* spatial hash, the mobs in bucket b are mobHashList[] from */
+	/* mobHashStart[b] up to mobHashStart[b + 1] */
+int mobHashStart[MOB_BUCKETS + 1];
+int *mobHashList = NULL;
+	/* neighbours looked at by the last stepMobs() and by each thread */
+long mobNeighbourTests = 0;
+long mobThreadTests[MAX_THREADS];
+
+/***********************/
+
+	/* grow or shrink one array to count floats, new entries are 0 */
+void *growMobArray(void *array, int size, int old, int count) {
+   array = realloc(array, (size_t) size * count);
+   if (array == NULL) {
+      printf("ERROR: unable to allocate memory for %d mobs\n", count);
+      exit(1);
+   }
+   if (count > old)
+      memset((char *) array + (size_t) size * old, 0,
+         (size_t) size * (count - old));
+   return(array);
+}
+
+	/* make room for mob number n */
+void growMobs(int n) {
+int capacity;
+
+   if (n < mobCapacity)
+      return;
+   capacity = (mobCapacity > 0) ? mobCapacity : FRUSTUM_BATCH;
+   while (capacity <= n)
+      capacity *= 2;
+   mobX = growMobArray(mobX, sizeof(float), mobCapacity, capacity);
+   mobY = growMobArray(mobY, sizeof(float), mobCapacity, capacity);
+   mobZ = growMobArray(mobZ, sizeof(float), mobCapacity, capacity);
+   mobAngle = growMobArray(mobAngle, sizeof(float), mobCapacity, capacity);
+   mobLastX = growMobArray(mobLastX, sizeof(float), mobCapacity, capacity);
+   mobLastY = growMobArray(mobLastY, sizeof(float), mobCapacity, capacity);
+   mobLastZ = growMobArray(mobLastZ, sizeof(float), mobCapacity, capacity);
+   mobLastAngle = growMobArray(mobLastAngle, sizeof(float), mobCapacity,
+      capacity);
+   mobNextX = growMobArray(mobNextX, sizeof(float), mobCapacity, capacity);
+   mobNextY = growMobArray(mobNextY, sizeof(float), mobCapacity, capacity);
+   mobNextZ = growMobArray(mobNextZ, sizeof(float), mobCapacity, capacity);
+   mobNextAngle = growMobArray(mobNextAngle, sizeof(float), mobCapacity,
+      capacity);
+   mobSpeedX = growMobArray(mobSpeedX, sizeof(float), mobCapacity, capacity);
+   mobSpeedY = growMobArray(mobSpeedY, sizeof(float), mobCapacity, capacity);
+   mobSpeedZ = growMobArray(mobSpeedZ, sizeof(float), mobCapacity, capacity);
+   mobShown = growMobArray(mobShown, 1, mobCapacity, capacity);
+   mobWalking = growMobArray(mobWalking, 1, mobCapacity, capacity);
+   mobDrawList = growMobArray(mobDrawList, sizeof(int), mobCapacity, capacity);
+   mobDrawn = growMobArray(mobDrawn, sizeof(float) * 4, mobCapacity, capacity);
+   mobHashList = growMobArray(mobHashList, sizeof(int), mobCapacity, capacity);
+   mobCapacity = capacity;
+}
+
+	/* check a mob number and make sure it has a place in the arrays */
+void useMob(int number) {
+   if (number < 0) {
+      printf("ERROR: mob number %d is less than 0\n", number);
+      exit(1);
+   }
+   growMobs(number);
+   if (number >= mobCount)
+      mobCount = number + 1;
+}
+
+	/* change how mob number is moved, counting the seeking mobs */
+void setMobWalking(int number, int walking) {
+   if (mobWalking[number] == MOB_SEEKING)
+      mobSeekCount--;
+   if (walking == MOB_SEEKING)
+      mobSeekCount++;
+   mobWalking[number] = walking;
+}
+
+/* mob control functions */
+/* remove all of the mobs */
+void initMobArray() {
+   if (mobCapacity > 0) {
+      memset(mobShown, 0, mobCapacity);
+      memset(mobWalking, 0, mobCapacity);
+      memset(mobSpeedX, 0, sizeof(float) * mobCapacity);
+      memset(mobSpeedY, 0, sizeof(float) * mobCapacity);
+      memset(mobSpeedZ, 0, sizeof(float) * mobCapacity);
+   }
+   mobCount = 0;
+   mobSeekCount = 0;
+   mobDrawCount = 0;
+}
+
+/* create mob with identifier "number" at x,y,z with */
+/* heading of rotx, roty, rotz */
+void createMob(int number, float x, float y, float z, float mobroty) {
+   useMob(number);
+   mobX[number] = mobLastX[number] = x;
+   mobY[number] = mobLastY[number] = y;
+   mobZ[number] = mobLastZ[number] = z;
+   mobAngle[number] = mobLastAngle[number] = mobroty;
+   mobSpeedX[number] = mobSpeedY[number] = mobSpeedZ[number] = 0.0;
+   mobShown[number] = 1;
+   setMobWalking(number, MOB_PLACED);
+}
+
+/* move mob to a new position xyz with rotation rotx,roty,rotz */
+/* stepMobs() stops moving it until setMobSpeed() is called again */
+void setMobPosition(int number, float x, float y, float z, float mobroty){
+   useMob(number);
+   mobX[number] = x;
+   mobY[number] = y;
+   mobZ[number] = z;
+   mobAngle[number] = mobroty;
+   setMobWalking(number, MOB_PLACED);
+}
+
+/* turn off drawing for mob number */
+void hideMob(int number) {
+   useMob(number);
+   mobShown[number] = 0;
+}
+
+/* turn on drawing for mob number */
+void showMob(int number) {
+   useMob(number);
+   mobShown[number] = 1;
+}
+
+	/* set the speed stepMobs() moves mob number at in cubes per tick */
+	/* and let stepMobs() move it */
+void setMobSpeed(int number, float x, float y, float z) {
+   useMob(number);
+   mobSpeedX[number] = x;
+   mobSpeedY[number] = y;
+   mobSpeedZ[number] = z;
+   setMobWalking(number, MOB_WALKING);
+}
+
+	/* keep the positions from before a tick so the mobs can be drawn */
+	/* between the ticks */
+void saveMobPositions() {
+   if (mobCount == 0)
+      return;
+   memcpy(mobLastX, mobX, sizeof(float) * mobCount);
+   memcpy(mobLastY, mobY, sizeof(float) * mobCount);
+   memcpy(mobLastZ, mobZ, sizeof(float) * mobCount);
+   memcpy(mobLastAngle, mobAngle, sizeof(float) * mobCount);
+}
+
+	/* put the shown mobs which are at least partly inside the frustum */
+	/* in mobDrawList[], the frustum must already have been calculated */
+void cullMobs() {
+float x[FRUSTUM_BATCH], y[FRUSTUM_BATCH], z[FRUSTUM_BATCH];
+unsigned int inside;
+int i, b;
+
+   mobDrawCount = 0;
+	/* the arrays are padded to a whole batch so the last batch can */
+	/* read past mobCount */
+   for(i=0; i<mobCount; i+=FRUSTUM_BATCH) {
+      for(b=0; b<FRUSTUM_BATCH; b++) {
+         x[b] = mobX[i + b] + 0.5;
+         y[b] = mobY[i + b] + 0.5;
+         z[b] = mobZ[i + b] + 0.5;
+      }
+      inside = CubeBatchInFrustum(x, y, z, 0.5);
+      for(b=0; (b<FRUSTUM_BATCH) && (i + b < mobCount); b++)
+         if ((mobShown[i + b] == 1) && (inside & (1 << b)))
+            mobDrawList[mobDrawCount++] = i + b;
+   }
+}
+
+	/* fill mobDrawn[] for the mobs in mobDrawList[] with positions */
+	/* blended from before the last tick towards the current ones */
+void blendMobs(float alpha) {
+int i, n;
+
+   for(i=0; i<mobDrawCount; i++) {
+      n = mobDrawList[i];
+      mobDrawn[i][0] = mobLastX[n] + alpha * (mobX[n] - mobLastX[n]);
+      mobDrawn[i][1] = mobLastY[n] + alpha * (mobY[n] - mobLastY[n]);
+      mobDrawn[i][2] = mobLastZ[n] + alpha * (mobZ[n] - mobLastZ[n]);
+      mobDrawn[i][3] = blendAngle(mobLastAngle[n], mobAngle[n], alpha);
+   }
+}
+
+	/* bucket of the hash cell holding x,y,z */
+int mobBucket(float x, float y, float z) {
+unsigned int cx, cy, cz;
+
+   cx = (unsigned int) (int) floorf(x / MOB_CELL);
+   cy = (unsigned int) (int) floorf(y / MOB_CELL);
+   cz = (unsigned int) (int) floorf(z / MOB_CELL);
+   return(((cx * 73856093u) ^ (cy * 19349663u) ^ (cz * 83492791u)) &
+      (MOB_BUCKETS - 1));
+}
+
+	/* sort the shown mobs into the buckets of the spatial hash */
+void hashMobs() {
+int i, b;
+
+   memset(mobHashStart, 0, sizeof(mobHashStart));
+   for(i=0; i<mobCount; i++)
+      if (mobShown[i] == 1)
+         mobHashStart[mobBucket(mobX[i], mobY[i], mobZ[i]) + 1]++;
+   for(b=0; b<MOB_BUCKETS; b++)
+      mobHashStart[b + 1] += mobHashStart[b];
+	/* the starts are moved along as the buckets are filled and put */
+	/* back afterwards */
+   for(i=0; i<mobCount; i++)
+      if (mobShown[i] == 1)
+         mobHashList[mobHashStart[mobBucket(mobX[i], mobY[i], mobZ[i])]++] = i;
+   for(b=MOB_BUCKETS; b>0; b--)
+      mobHashStart[b] = mobHashStart[b - 1];
+   mobHashStart[0] = 0;
+}
+
+	/* put up to max shown mobs within radius of x,y,z in found[] and */
+	/* return how many there are, uses the hash from the last hashMobs() */
+	/* so mobs which moved since then are found where they were */
+int mobsNear(float x, float y, float z, float radius, int found[], int max) {
+int count, b, i, n, last;
+float cx, cy, cz, dx, dy, dz;
+
+   count = 0;
+   for(cx=floorf((x - radius) / MOB_CELL) * MOB_CELL; cx<=x + radius; cx+=MOB_CELL)
+      for(cy=floorf((y - radius) / MOB_CELL) * MOB_CELL; cy<=y + radius; cy+=MOB_CELL)
+         for(cz=floorf((z - radius) / MOB_CELL) * MOB_CELL; cz<=z + radius; cz+=MOB_CELL) {
+            b = mobBucket(cx, cy, cz);
+            last = mobHashStart[b + 1];
+            for(i=mobHashStart[b]; i<last; i++) {
+               n = mobHashList[i];
+		/* different cells can share a bucket so a mob may be */
+		/* seen more than once, only the one in this cell counts */
+               if ((floorf(mobX[n] / MOB_CELL) * MOB_CELL != cx) ||
+                   (floorf(mobY[n] / MOB_CELL) * MOB_CELL != cy) ||
+                   (floorf(mobZ[n] / MOB_CELL) * MOB_CELL != cz))
+                  continue;
+               dx = mobX[n] - x;
+               dy = mobY[n] - y;
+               dz = mobZ[n] - z;
+               if (dx * dx + dy * dy + dz * dz > radius * radius)
+                  continue;
+               if (count == max)
+                  return(count);
+               found[count++] = n;
+            }
+         }
+   return(count);
+}
+
+	/* make mob number walk towards the target of the flow field */
+void seekMob(int number) {
+   useMob(number);
+   mobSpeedX[number] = mobSpeedZ[number] = 0.0;
+   setMobWalking(number, MOB_SEEKING);
+}
+
+	/* job run by each thread, move mobs job * MOB_JOB up to the next */
+	/* MOB_JOB one tick into the next arrays, mobs fall, push apart from */
+	/* the mobs next to them, turn back from walls and face the way they */
+	/* are going, the current positions and the world are only read and */
+	/* the speeds written belong to the mobs of this job */
+void stepMobJob(int job, int thread) {
+int near[MOB_NEIGHBOURS];
+float box[6], move[3], dx, dz, d;
+int i, j, n, first, last, count, hit;
+long tests;
+
+   tests = 0;
+   first = job * MOB_JOB;
+   last = (first + MOB_JOB < mobCount) ? first + MOB_JOB : mobCount;
+   for(i=first; i<last; i++) {
+      mobNextX[i] = mobX[i];
+      mobNextY[i] = mobY[i];
+      mobNextZ[i] = mobZ[i];
+      mobNextAngle[i] = mobAngle[i];
+      if ((mobShown[i] == 0) || (mobWalking[i] == MOB_PLACED))
+         continue;
+      if (mobWalking[i] == MOB_SEEKING) {
+         if (flowDirection(mobX[i] + 0.5, mobZ[i] + 0.5, &dx, &dz) == 1) {
+            mobSpeedX[i] = MOB_SEEK_SPEED * dx;
+            mobSpeedZ[i] = MOB_SEEK_SPEED * dz;
+         } else
+            mobSpeedX[i] = mobSpeedZ[i] = 0.0;
+      }
+
+      count = mobsNear(mobX[i], mobY[i], mobZ[i], MOB_SPACING, near,
+         MOB_NEIGHBOURS);
+      tests += count;
+      for(j=0; j<count; j++) {
+         n = near[j];
+         dx = mobX[i] - mobX[n];
+         dz = mobZ[i] - mobZ[n];
+         d = dx * dx + dz * dz;
+         if ((n == i) || (d == 0.0))
+            continue;
+         d = sqrtf(d);
+         mobSpeedX[i] += MOB_PUSH * dx / d;
+         mobSpeedZ[i] += MOB_PUSH * dz / d;
+      }
+      mobSpeedY[i] -= MOB_GRAVITY;
+
+      box[0] = mobX[i] + (1.0 - MOB_WIDTH) / 2.0;
+      box[1] = mobY[i];
+      box[2] = mobZ[i] + (1.0 - MOB_WIDTH) / 2.0;
+      box[3] = box[0] + MOB_WIDTH;
+      box[4] = box[1] + MOB_HEIGHT;
+      box[5] = box[2] + MOB_WIDTH;
+      move[0] = mobSpeedX[i];
+      move[1] = mobSpeedY[i];
+      move[2] = mobSpeedZ[i];
+      hit = sweepBox(box, move);
+      if (hit & 1)
+         mobSpeedX[i] = -mobSpeedX[i];
+      if (hit & 2)
+         mobSpeedY[i] = 0.0;
+      if (hit & 4)
+         mobSpeedZ[i] = -mobSpeedZ[i];
+      mobNextX[i] = box[0] - (1.0 - MOB_WIDTH) / 2.0;
+      mobNextY[i] = box[1];
+      mobNextZ[i] = box[2] - (1.0 - MOB_WIDTH) / 2.0;
+      if ((mobSpeedX[i] != 0.0) || (mobSpeedZ[i] != 0.0))
+         mobNextAngle[i] = atan2f(mobSpeedX[i], mobSpeedZ[i]) * 180.0 / M_PI;
+   }
+   mobThreadTests[thread] += tests;
+}
+
+	/* swap the current and next arrays of one value */
+void swapMobArrays(float **current, float **next) {
+float *t;
+
+   t = *current;
+   *current = *next;
+   *next = t;
+}
+
+	/* move every walking mob one tick using the job threads, hashMobs() */
+	/* must be called first, every mob sees the others where they were */
+	/* at the start of the tick so the result is the same for any */
+	/* number of threads */
+void stepMobs() {
+int t;
+
+   for(t=0; t<MAX_THREADS; t++)
+      mobThreadTests[t] = 0;
+   runJobs((mobCount + MOB_JOB - 1) / MOB_JOB, stepMobJob);
+   swapMobArrays(&mobX, &mobNextX);
+   swapMobArrays(&mobY, &mobNextY);
+   swapMobArrays(&mobZ, &mobNextZ);
+   swapMobArrays(&mobAngle, &mobNextAngle);
+   mobNeighbourTests = 0;
+   for(t=0; t<MAX_THREADS; t++)
+      mobNeighbourTests += mobThreadTests[t];
+}
+
+	/* called once a tick after update(), moves the walking and */
+	/* seeking mobs, the flow field is left alone while no mob follows */
+	/* it and the cubes which change meanwhile are repaired later */
+void tickMobs() {
+   if (mobCount == 0)
+      return;
+   if (mobSeekCount > 0)
+      updateFlowField();
+   hashMobs();
+   stepMobs();
+}
@@ -0,0 +1,411 @@
+/* Occlusion culling using a small software depth buffer. Large vertical */
+/* spans of solid cubes near the viewpoint, such as the maze walls and */
+/* pillars, are drawn into the buffer each frame. Octree nodes, cubes and */
+/* chunks which are completely behind them are not drawn. The buffer */
+/* holds the farthest depth of each pixel so the tests are conservative, */
+/* a box is only hidden when every pixel it covers is closer. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "graphics.h"
+
+	/* size of the depth buffer, a power of two */
+#define OCC_SIZE 64
+	/* number of levels in the depth pyramid, the last is 1 by 1 */
+#define OCC_LEVELS 7
+	/* distance from the viewpoint searched for occluders */
+#define OCCLUDER_RANGE 24
+	/* smallest width and height of an occluder in cubes */
+#define OCCLUDER_MIN 2
+#define MAX_OCCLUDERS 512
+	/* corners closer than this to the viewpoint can't be projected */
+#define OCC_NEAR 0.1
+
+	/* flag which is set to 0 when occlusion culling is turned off */
+extern int occlusion;
+extern GLubyte getWorldCube(int, int, int);
+
+	/* a box of solid cubes from b up to but not including t */
+typedef struct _Occluder {
+   int bx, by, bz;
+   int tx, ty, tz;
+} Occluder;
+
+	/* the occluders found in one vertical plane through the world */
+	/* they are found again when dirty is set by a change to the plane */
+typedef struct _OccluderPlane {
+   int dirty;
+   int count;
+   int alloc;
+   Occluder *list;
+} OccluderPlane;
+
+	/* WORLDX planes with constant x and WORLDZ planes with constant z */
+OccluderPlane *occPlaneX = NULL;
+OccluderPlane *occPlaneZ = NULL;
+	/* solid cubes in the plane being searched, one byte per cube */
+unsigned char *occMask = NULL;
+
+	/* occluders near the viewpoint which are drawn this frame */
+Occluder occluder[MAX_OCCLUDERS];
+int occluderCount = 0;
+
+	/* farthest depth in each pixel, level n is OCC_SIZE >> n pixels */
+	/* wide and each pixel is the farthest of four in the level above */
+float occDepth[OCC_LEVELS][OCC_SIZE * OCC_SIZE];
+	/* projection times modelview and the viewpoint in world space */
+float occMatrix[16];
+float occEye[3];
+	/* set to 1 when the buffer is ready to be used this frame */
+int occReady = 0;
+
+/***********************/
+
+	/* mark the planes through the cubes from bx,bz up to but not */
+	/* including tx,tz as changed */
+void dirtyOccluders(int bx, int bz, int tx, int tz) {
+int i;
+
+   if (occPlaneX == NULL)
+      return;
+   for(i=bx; i<tx; i++)
+      occPlaneX[i].dirty = 1;
+   for(i=bz; i<tz; i++)
+      occPlaneZ[i].dirty = 1;
+}
+
+	/* find rectangles of solid cubes in plane p, plane d = 0 has */
+	/* constant x and spans z and y, d = 2 has constant z and spans x */
+	/* and y, neighbouring cubes are merged the same way as the chunk */
+	/* geometry */
+void findOccluders(int d, int p) {
+OccluderPlane *plane;
+Occluder *o;
+unsigned char *mask;
+int u, v, w, h, k, length;
+
+   plane = (d == 0) ? &occPlaneX[p] : &occPlaneZ[p];
+   plane->dirty = 0;
+   plane->count = 0;
+   length = (d == 0) ? WORLDZ : WORLDX;
+   mask = occMask;
+   for(u=0; u<length; u++)
+      for(v=0; v<WORLDY; v++)
+         mask[u * WORLDY + v] = (d == 0) ? (getWorldCube(p, v, u) != 0)
+            : (getWorldCube(u, v, p) != 0);
+
+   for(u=0; u<length; u++)
+      for(v=0; v<WORLDY; ) {
+         if (mask[u * WORLDY + v] == 0) {
+            v++;
+            continue;
+         }
+         for(h=1; (v+h < WORLDY) && (mask[u * WORLDY + v + h] == 1); h++);
+         for(w=1; u+w < length; w++) {
+            for(k=0; (k < h) && (mask[(u + w) * WORLDY + v + k] == 1); k++);
+            if (k < h)
+               break;
+         }
+         for(k=0; k<w; k++)
+            memset(&mask[(u + k) * WORLDY + v], 0, h);
+         if ((w >= OCCLUDER_MIN) && (h >= OCCLUDER_MIN)) {
+            if (plane->count == plane->alloc) {
+               plane->alloc = (plane->alloc == 0) ? 16 : plane->alloc * 2;
+               plane->list = realloc(plane->list, sizeof(Occluder) * plane->alloc);
+               if (plane->list == NULL) {
+                  printf("ERROR: unable to allocate memory for the occluders\n");
+                  exit(1);
+               }
+            }
+            o = &plane->list[plane->count++];
+            o->by = v;
+            o->ty = v + h;
+            if (d == 0) {
+               o->bx = p;  o->tx = p + 1;
+               o->bz = u;  o->tz = u + w;
+            } else {
+               o->bz = p;  o->tz = p + 1;
+               o->bx = u;  o->tx = u + w;
+            }
+         }
+         v += h;
+      }
+}
+
+	/* collect the occluders which come within OCCLUDER_RANGE of the */
+	/* viewpoint, planes which have changed are searched again first */
+void gatherOccluders(int ex, int ey, int ez) {
+OccluderPlane *plane;
+Occluder *o;
+int d, p, pb, pt, i;
+
+   if (occPlaneX == NULL) {
+      occPlaneX = calloc(WORLDX, sizeof(OccluderPlane));
+      occPlaneZ = calloc(WORLDZ, sizeof(OccluderPlane));
+      occMask = malloc(((WORLDX > WORLDZ) ? WORLDX : WORLDZ) * WORLDY);
+      if ((occPlaneX == NULL) || (occPlaneZ == NULL) || (occMask == NULL)) {
+         printf("ERROR: unable to allocate memory for the occluders\n");
+         exit(1);
+      }
+      dirtyOccluders(0, 0, WORLDX, WORLDZ);
+   }
+   occluderCount = 0;
+   for(d=0; d<3; d+=2) {
+      pb = ((d == 0) ? ex : ez) - OCCLUDER_RANGE;
+      pt = ((d == 0) ? ex : ez) + OCCLUDER_RANGE + 1;
+      if (pb < 0) pb = 0;
+      if (pt > ((d == 0) ? WORLDX : WORLDZ)) pt = (d == 0) ? WORLDX : WORLDZ;
+      for(p=pb; p<pt; p++) {
+         plane = (d == 0) ? &occPlaneX[p] : &occPlaneZ[p];
+         if (plane->dirty == 1)
+            findOccluders(d, p);
+         for(i=0; i<plane->count; i++) {
+            o = &plane->list[i];
+            if ((o->ty <= ey - OCCLUDER_RANGE) || (o->by > ey + OCCLUDER_RANGE))
+               continue;
+            if ((d == 0) && ((o->tz <= ez - OCCLUDER_RANGE) ||
+                (o->bz > ez + OCCLUDER_RANGE)))
+               continue;
+            if ((d == 2) && ((o->tx <= ex - OCCLUDER_RANGE) ||
+                (o->bx > ex + OCCLUDER_RANGE)))
+               continue;
+            if (occluderCount == MAX_OCCLUDERS)
+               return;
+            occluder[occluderCount++] = *o;
+         }
+      }
+   }
+}
+
+	/* transform a world position into clip space */
+void occTransform(float x, float y, float z, float c[4]) {
+float *m = occMatrix;
+
+   c[0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+   c[1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+   c[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+   c[3] = m[3] * x + m[7] * y + m[11] * z + m[15];
+}
+
+	/* project a world position into the depth buffer, returns 0 if */
+	/* it is too close to or behind the viewpoint */
+int occProject(float x, float y, float z, float *sx, float *sy, float *sz) {
+float c[4];
+
+   occTransform(x, y, z, c);
+   if (c[3] < OCC_NEAR)
+      return(0);
+   *sx = (c[0] / c[3] * 0.5 + 0.5) * OCC_SIZE;
+   *sy = (c[1] / c[3] * 0.5 + 0.5) * OCC_SIZE;
+   *sz = c[2] / c[3];
+   return(1);
+}
+
+	/* draw a projected convex polygon with n corners into the depth */
+	/* buffer, only pixels which are completely covered are written */
+	/* and they get the farthest depth of the polygon inside the pixel */
+void occDrawPolygon(float q[][3], int n) {
+float ea[5], eb[5], ec[5];
+float area, za, zb, zc, det, depth, e;
+int x, y, x0, x1, y0, y1, i, inside;
+
+	/* depth is a plane in screen space, z = za * x + zb * y + zc */
+   det = (q[1][0] - q[0][0]) * (q[2][1] - q[0][1])
+       - (q[2][0] - q[0][0]) * (q[1][1] - q[0][1]);
+   if (fabsf(det) < 1.0e-6)
+      return;
+   za = ((q[1][2] - q[0][2]) * (q[2][1] - q[0][1])
+       - (q[2][2] - q[0][2]) * (q[1][1] - q[0][1])) / det;
+   zb = ((q[2][2] - q[0][2]) * (q[1][0] - q[0][0])
+       - (q[1][2] - q[0][2]) * (q[2][0] - q[0][0])) / det;
+   zc = q[0][2] - za * q[0][0] - zb * q[0][1];
+	/* the farthest corner of a pixel is the one up the depth slope */
+   zc += ((za > 0.0) ? za : 0.0) + ((zb > 0.0) ? zb : 0.0);
+
+	/* edges are ea * x + eb * y + ec, positive inside the polygon */
+	/* and ec is moved to the pixel corner closest to the outside */
+   area = (det > 0.0) ? 1.0 : -1.0;
+   for(i=0; i<n; i++) {
+      ea[i] = -(q[(i + 1) % n][1] - q[i][1]) * area;
+      eb[i] = (q[(i + 1) % n][0] - q[i][0]) * area;
+      ec[i] = -ea[i] * q[i][0] - eb[i] * q[i][1];
+      ec[i] += ((ea[i] < 0.0) ? ea[i] : 0.0) + ((eb[i] < 0.0) ? eb[i] : 0.0);
+   }
+
+   x0 = x1 = (int) floorf(q[0][0]);
+   y0 = y1 = (int) floorf(q[0][1]);
+   for(i=1; i<n; i++) {
+      if (q[i][0] < x0) x0 = (int) floorf(q[i][0]);
+      if (q[i][0] > x1) x1 = (int) floorf(q[i][0]);
+      if (q[i][1] < y0) y0 = (int) floorf(q[i][1]);
+      if (q[i][1] > y1) y1 = (int) floorf(q[i][1]);
+   }
+   if (x0 < 0) x0 = 0;
+   if (y0 < 0) y0 = 0;
+   if (x1 > OCC_SIZE) x1 = OCC_SIZE;
+   if (y1 > OCC_SIZE) y1 = OCC_SIZE;
+
+   for(y=y0; y<y1; y++)
+      for(x=x0; x<x1; x++) {
+         inside = 1;
+         for(i=0; i<n; i++) {
+            e = ea[i] * x + eb[i] * y + ec[i];
+            if (e < 0.0) {
+               inside = 0;
+               break;
+            }
+         }
+         if (inside == 0)
+            continue;
+         depth = za * x + zb * y + zc;
+         if (depth < occDepth[0][y * OCC_SIZE + x])
+            occDepth[0][y * OCC_SIZE + x] = depth;
+      }
+}
+
+	/* draw the faces of an occluder which face the viewpoint, the */
+	/* parts of a face behind the near plane are clipped off so the */
+	/* walls beside the viewpoint are still drawn */
+void occDrawBox(Occluder *o) {
+static int face[6][4][3] = {
+   {{0,0,0}, {0,0,1}, {0,1,1}, {0,1,0}},
+   {{1,0,0}, {1,1,0}, {1,1,1}, {1,0,1}},
+   {{0,0,0}, {1,0,0}, {1,0,1}, {0,0,1}},
+   {{0,1,0}, {0,1,1}, {1,1,1}, {1,1,0}},
+   {{0,0,0}, {0,1,0}, {1,1,0}, {1,0,0}},
+   {{0,0,1}, {1,0,1}, {1,1,1}, {0,1,1}} };
+float c[4][4], q[5][3];
+float b[3], t[3], *p, *r, s;
+int f, i, n, axis;
+
+   b[0] = o->bx;  b[1] = o->by;  b[2] = o->bz;
+   t[0] = o->tx;  t[1] = o->ty;  t[2] = o->tz;
+   for(f=0; f<6; f++) {
+		/* face f is on the low side of the axis when f is even */
+      axis = f / 2;
+      if ((f % 2 == 0) && (occEye[axis] >= b[axis]))
+         continue;
+      if ((f % 2 == 1) && (occEye[axis] <= t[axis]))
+         continue;
+      for(i=0; i<4; i++)
+         occTransform(face[f][i][0] ? t[0] : b[0], face[f][i][1] ? t[1] : b[1],
+            face[f][i][2] ? t[2] : b[2], c[i]);
+
+		/* clip against w = OCC_NEAR, a quad gains at most one corner */
+      n = 0;
+      for(i=0; i<4; i++) {
+         p = c[i];
+         r = c[(i + 1) % 4];
+         if (p[3] >= OCC_NEAR) {
+            q[n][0] = (p[0] / p[3] * 0.5 + 0.5) * OCC_SIZE;
+            q[n][1] = (p[1] / p[3] * 0.5 + 0.5) * OCC_SIZE;
+            q[n][2] = p[2] / p[3];
+            n++;
+         }
+         if ((p[3] >= OCC_NEAR) != (r[3] >= OCC_NEAR)) {
+            s = (OCC_NEAR - p[3]) / (r[3] - p[3]);
+            q[n][0] = ((p[0] + (r[0] - p[0]) * s) / OCC_NEAR * 0.5 + 0.5)
+               * OCC_SIZE;
+            q[n][1] = ((p[1] + (r[1] - p[1]) * s) / OCC_NEAR * 0.5 + 0.5)
+               * OCC_SIZE;
+            q[n][2] = (p[2] + (r[2] - p[2]) * s) / OCC_NEAR;
+            n++;
+         }
+      }
+      if (n >= 3)
+         occDrawPolygon(q, n);
+   }
+}
+
+	/* prepare the depth buffer for a frame using the same matrices as */
+	/* the frustum */
+void buildOcclusion(float proj[16], float modl[16]) {
+int i, j, level, size, x, y, ex, ey, ez;
+float *src, *dst, a, b;
+
+   occReady = 0;
+   if (occlusion == 0)
+      return;
+
+   for(i=0; i<4; i++)
+      for(j=0; j<4; j++)
+         occMatrix[i * 4 + j] = modl[i * 4] * proj[j] + modl[i * 4 + 1] * proj[4 + j]
+            + modl[i * 4 + 2] * proj[8 + j] + modl[i * 4 + 3] * proj[12 + j];
+	/* the modelview is a rotation and translation so the viewpoint */
+	/* is the translation moved back through the rotation */
+   for(i=0; i<3; i++)
+      occEye[i] = -(modl[i * 4] * modl[12] + modl[i * 4 + 1] * modl[13]
+         + modl[i * 4 + 2] * modl[14]);
+
+   ex = (int) floorf(occEye[0]);
+   ey = (int) floorf(occEye[1]);
+   ez = (int) floorf(occEye[2]);
+   gatherOccluders(ex, ey, ez);
+
+   for(i=0; i<OCC_SIZE * OCC_SIZE; i++)
+      occDepth[0][i] = 1.0;
+   for(i=0; i<occluderCount; i++)
+      occDrawBox(&occluder[i]);
+
+	/* each level keeps the farthest depth of four pixels above it */
+   for(level=1; level<OCC_LEVELS; level++) {
+      size = OCC_SIZE >> level;
+      src = occDepth[level - 1];
+      dst = occDepth[level];
+      for(y=0; y<size; y++)
+         for(x=0; x<size; x++) {
+            a = fmaxf(src[(y * 2) * size * 2 + x * 2],
+               src[(y * 2) * size * 2 + x * 2 + 1]);
+            b = fmaxf(src[(y * 2 + 1) * size * 2 + x * 2],
+               src[(y * 2 + 1) * size * 2 + x * 2 + 1]);
+            dst[y * size + x] = fmaxf(a, b);
+         }
+   }
+   occReady = 1;
+}
+
+	/* returns 1 if the box from bx,by,bz to tx,ty,tz is completely */
+	/* hidden by the occluders drawn this frame */
+int boxOccluded(float bx, float by, float bz, float tx, float ty, float tz) {
+float sx, sy, sz, xmin, xmax, ymin, ymax, zmin;
+int c, x, y, x0, x1, y0, y1, level, size;
+float *depth;
+
+   if (occReady == 0)
+      return(0);
+
+   xmin = ymin = zmin = 1.0e9;
+   xmax = ymax = -1.0e9;
+   for(c=0; c<8; c++) {
+      if (occProject((c & 1) ? tx : bx, (c & 2) ? ty : by, (c & 4) ? tz : bz,
+            &sx, &sy, &sz) == 0)
+         return(0);
+      if (sx < xmin) xmin = sx;
+      if (sx > xmax) xmax = sx;
+      if (sy < ymin) ymin = sy;
+      if (sy > ymax) ymax = sy;
+      if (sz < zmin) zmin = sz;
+   }
+   if ((xmax <= 0.0) || (ymax <= 0.0) || (xmin >= OCC_SIZE) || (ymin >= OCC_SIZE))
+      return(0);
+   x0 = (xmin < 0.0) ? 0 : (int) xmin;
+   y0 = (ymin < 0.0) ? 0 : (int) ymin;
+   x1 = (xmax >= OCC_SIZE) ? OCC_SIZE - 1 : (int) xmax;
+   y1 = (ymax >= OCC_SIZE) ? OCC_SIZE - 1 : (int) ymax;
+
+	/* use the first level where the box covers at most 4 by 4 pixels */
+   level = 0;
+   while (((x1 >> level) - (x0 >> level) > 3) ||
+          ((y1 >> level) - (y0 >> level) > 3))
+      level++;
+   size = OCC_SIZE >> level;
+   depth = occDepth[level];
+   for(y=y0>>level; y<=y1>>level; y++)
+      for(x=x0>>level; x<=x1>>level; x++)
+         if (depth[y * size + x] >= zmin)
+            return(0);
+   return(1);
+}
@@ -0,0 +1,105 @@
+/* Sparse octree over the world array used to skip areas during culling. */
+/* Each node counts the non empty cubes and the exposed cubes inside it. */
+/* Nodes are only created where there are non empty cubes so the empty */
+/* parts of the world have no nodes. Nodes are not divided below the */
+/* depth tree() stops at, the surface bits of each chunk find the cubes */
+/* inside the smallest nodes. The counts are kept current by world.c as */
+/* cubes are changed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics.h"
+
+	/* depth at which tree() stops dividing nodes, set with -octree */
+extern int octreeLevel;
+
+OctreeNode *octreeNode = NULL;
+int octreeCount = 0;
+int octreeAlloc = 0;
+	/* length of the edge of the root node, a power of two which */
+	/* is at least as large as every dimension of the world */
+int octreeSize = 0;
+	/* number of levels below the root and the edge of the nodes at */
+	/* that depth, which have no children, this is the -octree level */
+	/* but never smaller than a chunk */
+int octreeDepth = 0;
+int octreeLeaf = 0;
+
+/***********************/
+
+	/* returns the index of a new node with no cubes or children */
+int newOctreeNode() {
+   if (octreeCount == octreeAlloc) {
+      octreeAlloc = (octreeAlloc == 0) ? 1024 : octreeAlloc * 2;
+      octreeNode = realloc(octreeNode, sizeof(OctreeNode) * octreeAlloc);
+      if (octreeNode == NULL) {
+         printf("ERROR: unable to allocate memory for the octree\n");
+         exit(1);
+      }
+   }
+   memset(&octreeNode[octreeCount], 0, sizeof(OctreeNode));
+   return(octreeCount++);
+}
+
+	/* remove every node and create an empty root large enough to */
+	/* hold the world */
+void octreeInit() {
+int largest;
+
+   largest = WORLDX;
+   if (WORLDY > largest) largest = WORLDY;
+   if (WORLDZ > largest) largest = WORLDZ;
+   octreeSize = 1;
+   while (octreeSize < largest)
+      octreeSize *= 2;
+   octreeLeaf = octreeSize;
+   octreeDepth = 0;
+   while ((octreeDepth < octreeLevel) && (octreeLeaf / 2 >= CHUNK_SIZE)) {
+      octreeLeaf /= 2;
+      octreeDepth++;
+   }
+   octreeCount = 0;
+   newOctreeNode();
+}
+
+	/* add dsolid and dexposed to the counts of every node containing */
+	/* the cube at x,y,z down to octreeDepth, missing nodes are created */
+	/* on the way down */
+void octreeUpdate(int x, int y, int z, int dsolid, int dexposed) {
+int node, size, c, child;
+
+   node = 0;
+   size = octreeSize;
+   while (1) {
+      octreeNode[node].solid += dsolid;
+      octreeNode[node].exposed += dexposed;
+      if (size == octreeLeaf)
+         break;
+      size /= 2;
+      c = ((x & size) ? 1 : 0) | ((y & size) ? 2 : 0) | ((z & size) ? 4 : 0);
+      child = octreeNode[node].child[c];
+      if (child == 0) {
+		/* newOctreeNode() can move the array so store the index */
+         child = newOctreeNode();
+         octreeNode[node].child[c] = child;
+      }
+      node = child;
+   }
+}
+
+	/* returns OCTREE_EMPTY, OCTREE_FULL or OCTREE_MIXED for a node with */
+	/* corner x,y,z and edge size, only the part inside the world counts */
+int octreeState(int node, int x, int y, int z, int size) {
+int sx, sy, sz;
+
+   if (octreeNode[node].solid == 0)
+      return(OCTREE_EMPTY);
+   sx = (x + size > WORLDX) ? WORLDX - x : size;
+   sy = (y + size > WORLDY) ? WORLDY - y : size;
+   sz = (z + size > WORLDZ) ? WORLDZ - z : size;
+   if (octreeNode[node].solid == sx * sy * sz)
+      return(OCTREE_FULL);
+   return(OCTREE_MIXED);
+}
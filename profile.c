@@ -0,0 +1,229 @@
+/* Per frame profiler. profileBegin() and profileEnd() time a phase of */
+/* the frame and add a sample to a ring buffer which any thread can */
+/* write to without a lock. Phases may be nested, the time spent in the */
+/* nested phases is taken out of the self time of the outer one. The */
+/* last PROFILE_BARS frames are drawn as a bar graph by drawProfile() */
+/* and the samples still in the ring can be written when the program */
+/* exits, as CSV or as a Chrome trace if the file name ends in .json. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics.h"
+
+	/* samples kept, a power of two so the ring index is a mask */
+#define PROFILE_RING 65536
+	/* deepest nesting of phases on one thread */
+#define PROFILE_DEPTH 8
+	/* frames shown in the bar graph and the size of each bar */
+#define PROFILE_BARS 120
+#define PROFILE_BAR_WIDTH 3
+#define PROFILE_PIXELS_PER_MS 6
+	/* frame time marked on the graph, one frame at 60 frames a second */
+#define PROFILE_BUDGET_MS 16.7
+
+extern double benchClock();
+extern void draw2Dbox(int, int, int, int);
+extern void draw2Dline(int, int, int, int, int);
+extern void set2Dcolour(float []);
+
+	/* one timed phase, start is in ms since the profiler started, ms */
+	/* is the whole time and self leaves out the nested phases */
+typedef struct _ProfileSample {
+   int frame;
+   int phase;
+   int thread;
+   float ms;
+   float self;
+   double start;
+} ProfileSample;
+
+	/* 1 when -profile is used */
+int profiling = 0;
+	/* file the samples are written to when the program exits, or NULL */
+char *profileFile = NULL;
+	/* number of the frame being profiled */
+int profileFrame = 0;
+
+	/* the ring, profileHead counts every sample ever added */
+ProfileSample profileRing[PROFILE_RING];
+unsigned int profileHead = 0;
+	/* clock when the profiler started and the threads seen so far */
+double profileEpoch = 0.0;
+int profileThreads = 0;
+
+	/* phases being timed on this thread, innermost last, with the */
+	/* time spent in the phases nested inside each one */
+__thread int profileDepth = 0;
+__thread int profilePhase[PROFILE_DEPTH];
+__thread double profileStart[PROFILE_DEPTH];
+__thread double profileNested[PROFILE_DEPTH];
+__thread int profileThread = -1;
+
+char *profileName[PROFILE_PHASES] = {"frustum", "cull", "mobs", "cubes",
+   "update", "collision", "walls"};
+	/* colour of each phase in the bar graph */
+float profileColour[PROFILE_PHASES][4] = {
+   {1.0, 1.0, 0.0, 0.8},
+   {1.0, 0.5, 0.0, 0.8},
+   {1.0, 0.0, 1.0, 0.8},
+   {0.0, 0.6, 1.0, 0.8},
+   {0.0, 0.8, 0.0, 0.8},
+   {1.0, 0.0, 0.0, 0.8},
+   {1.0, 1.0, 1.0, 0.8}};
+
+/***********************/
+
+	/* start timing phase on the calling thread */
+void profileBegin(int phase) {
+   if (profiling == 0)
+      return;
+	/* phases nested too deeply are counted but not timed */
+   if (profileDepth < PROFILE_DEPTH) {
+      profilePhase[profileDepth] = phase;
+      profileNested[profileDepth] = 0.0;
+      profileStart[profileDepth] = benchClock();
+   }
+   profileDepth++;
+}
+
+	/* stop timing the innermost phase on the calling thread and add a */
+	/* sample for it to the ring */
+void profileEnd() {
+ProfileSample *sample;
+double end, ms;
+unsigned int slot;
+
+   if ((profiling == 0) || (profileDepth == 0))
+      return;
+   if (--profileDepth >= PROFILE_DEPTH)
+      return;
+   end = benchClock();
+   ms = end - profileStart[profileDepth];
+   if (profileDepth > 0)
+      profileNested[profileDepth - 1] += ms;
+   if (profileThread < 0)
+      profileThread = __atomic_fetch_add(&profileThreads, 1, __ATOMIC_RELAXED);
+
+	/* a writer owns its slot once it has moved the head past it */
+   slot = __atomic_fetch_add(&profileHead, 1, __ATOMIC_RELAXED) &
+      (PROFILE_RING - 1);
+   sample = &profileRing[slot];
+   sample->frame = profileFrame;
+   sample->phase = profilePhase[profileDepth];
+   sample->thread = profileThread;
+   sample->ms = ms;
+   sample->self = ms - profileNested[profileDepth];
+   sample->start = profileStart[profileDepth] - profileEpoch;
+}
+
+	/* called at the start of each frame */
+void profileNextFrame() {
+   if (profiling == 1)
+      profileFrame++;
+}
+
+	/* number of samples in the ring and the index of the oldest */
+int profileSamples(unsigned int *oldest) {
+unsigned int head;
+
+   head = __atomic_load_n(&profileHead, __ATOMIC_ACQUIRE);
+   if (head > PROFILE_RING) {
+      *oldest = head - PROFILE_RING;
+      return(PROFILE_RING);
+   }
+   *oldest = 0;
+   return(head);
+}
+
+	/* write the samples in the ring to profileFile, called at exit */
+void dumpProfile() {
+ProfileSample *sample;
+unsigned int oldest;
+int i, count, json;
+FILE *fp;
+
+   if ((fp = fopen(profileFile, "w")) == NULL) {
+      printf("ERROR: unable to create profile %s\n", profileFile);
+      return;
+   }
+   count = profileSamples(&oldest);
+   json = (strlen(profileFile) > 5) &&
+      (strcmp(profileFile + strlen(profileFile) - 5, ".json") == 0);
+
+   if (json)
+      fprintf(fp, "{\"traceEvents\":[\n");
+   else
+      fprintf(fp, "frame,phase,thread,start ms,ms,self ms\n");
+   for(i=0; i<count; i++) {
+      sample = &profileRing[(oldest + i) & (PROFILE_RING - 1)];
+      if (json)
+         fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f,\"args\":{\"frame\":%d}}\n",
+            (i > 0) ? "," : "", profileName[sample->phase], sample->thread,
+            sample->start * 1000.0, sample->ms * 1000.0, sample->frame);
+      else
+         fprintf(fp, "%d,%s,%d,%.4f,%.4f,%.4f\n", sample->frame,
+            profileName[sample->phase], sample->thread, sample->start,
+            sample->ms, sample->self);
+   }
+   if (json)
+      fprintf(fp, "]}\n");
+   if (ferror(fp) || (fclose(fp) != 0))
+      printf("ERROR: unable to write profile %s\n", profileFile);
+}
+
+	/* start the profiler, the samples are written at exit when a */
+	/* file was given */
+void profileInit() {
+   if (profiling == 0)
+      return;
+   profileEpoch = benchClock();
+   if (profileFile != NULL)
+      atexit(dumpProfile);
+}
+
+	/* draw the self time of each phase in the last PROFILE_BARS frames */
+	/* as stacked bars in the bottom left corner of the screen, the */
+	/* line across the graph is PROFILE_BUDGET_MS */
+void drawProfile() {
+static float bar[PROFILE_BARS][PROFILE_PHASES];
+float line[] = {1.0, 1.0, 1.0, 0.5};
+ProfileSample *sample;
+unsigned int oldest;
+int i, p, count, first, x, y, height;
+
+   if (profiling == 0)
+      return;
+
+	/* the samples are read from the newest back to the first one */
+	/* before the graph, the frame being drawn is not finished so it */
+	/* is left out */
+   memset(bar, 0, sizeof(bar));
+   first = profileFrame - PROFILE_BARS;
+   count = profileSamples(&oldest);
+   for(i=count-1; i>=0; i--) {
+      sample = &profileRing[(oldest + i) & (PROFILE_RING - 1)];
+      if (sample->frame < first)
+         break;
+      if ((sample->frame < profileFrame) &&
+          (sample->phase >= 0) && (sample->phase < PROFILE_PHASES))
+         bar[sample->frame - first][sample->phase] += sample->self;
+   }
+
+   for(i=0; i<PROFILE_BARS; i++) {
+      x = 10 + i * PROFILE_BAR_WIDTH;
+      y = 10;
+      for(p=0; p<PROFILE_PHASES; p++) {
+         height = (int) (bar[i][p] * PROFILE_PIXELS_PER_MS + 0.5);
+         if (height == 0)
+            continue;
+         set2Dcolour(profileColour[p]);
+         draw2Dbox(x, y, x + PROFILE_BAR_WIDTH - 1, y + height);
+         y += height;
+      }
+   }
+   set2Dcolour(line);
+   y = 10 + (int) (PROFILE_BUDGET_MS * PROFILE_PIXELS_PER_MS);
+   draw2Dline(10, y, 10 + PROFILE_BARS * PROFILE_BAR_WIDTH, y, 1);
+}
@@ -0,0 +1,314 @@
+/* Recording and replaying a session. -record writes the random seed */
+/* and every keyboard and mouse event with the tick it arrived after to */
+/* a file. -replay reads the file back, seeds the random numbers the */
+/* same way and runs the same ticks headless as fast as possible, */
+/* feeding each event in before the tick it arrived before, so two */
+/* builds can be timed on exactly the same session. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics.h"
+
+#define REPLAY_MAGIC "A1INPUT"
+	/* increased whenever the layout of the file changes */
+#define REPLAY_VERSION 1
+
+#define STAGE_INPUT 0
+#define STAGE_UPDATE 1
+#define STAGE_CULL 2
+#define STAGE_COUNT 3
+
+extern void update();
+extern void runQueuedMoves();
+extern void tickMobs();
+extern void buildDisplayList();
+extern void keyboard(unsigned char, int, int);
+extern void motion(int, int);
+extern void passivemotion(int, int);
+extern void getViewPosition(float *, float *, float *);
+extern void getViewOrientation(float *, float *, float *);
+extern double benchClock();
+extern void profileBegin(int);
+extern void profileEnd();
+
+extern int testWorld;
+extern int tickRate;
+extern int simTicks;
+extern int meshCubes;
+extern int displayCount;
+extern int meshChunkCount;
+extern int meshQuadCount;
+extern int streamRadius;
+
+	/* start of a replay file, the events follow it */
+typedef struct _ReplayHeader {
+   char magic[8];
+   int version;
+   unsigned int seed;
+   int tickRate;
+   int testWorld;
+   int x, y, z;
+} ReplayHeader;
+
+	/* one input event, tick is the number of ticks which had run when */
+	/* it arrived, type is one of the REPLAY_ values in graphics.h and */
+	/* a and b are the key or the mouse position */
+typedef struct _ReplayEvent {
+   int tick;
+   int type;
+   int a, b;
+} ReplayEvent;
+
+	/* file names given with -record and -replay, NULL if not used */
+char *recordFile = NULL;
+char *replayFile = NULL;
+	/* file the time of each replayed tick is written to, or NULL */
+char *frameTimesFile = NULL;
+
+	/* the recording being written */
+FILE *recording = NULL;
+	/* the events read from the replay file and the next one to use */
+ReplayEvent *replayEvent = NULL;
+int replayCount = 0;
+int replayNext = 0;
+
+char *replayStageName[STAGE_COUNT] = {"input", "update", "cull"};
+
+/***********************/
+
+	/* write the end of the recording, called when the program exits */
+void finishRecording() {
+ReplayEvent event;
+
+   if (recording == NULL)
+      return;
+   event.tick = simTicks;
+   event.type = REPLAY_END;
+   event.a = event.b = 0;
+   fwrite(&event, sizeof(event), 1, recording);
+   if (ferror(recording) || (fclose(recording) != 0))
+      printf("ERROR: unable to write recording %s\n", recordFile);
+   recording = NULL;
+}
+
+	/* add an input event to the recording if one is being made */
+void recordInput(int type, int a, int b) {
+ReplayEvent event;
+
+   if (recording == NULL)
+      return;
+   event.tick = simTicks;
+   event.type = type;
+   event.a = a;
+   event.b = b;
+   fwrite(&event, sizeof(event), 1, recording);
+}
+
+	/* create the recording file and write its header */
+void startRecording(unsigned int seed) {
+ReplayHeader header;
+
+   if ((recording = fopen(recordFile, "wb")) == NULL) {
+      printf("ERROR: unable to create recording %s\n", recordFile);
+      exit(1);
+   }
+   memset(&header, 0, sizeof(header));
+   strcpy(header.magic, REPLAY_MAGIC);
+   header.version = REPLAY_VERSION;
+   header.seed = seed;
+   header.tickRate = tickRate;
+   header.testWorld = testWorld;
+   header.x = WORLDX;
+   header.y = WORLDY;
+   header.z = WORLDZ;
+   fwrite(&header, sizeof(header), 1, recording);
+   atexit(finishRecording);
+}
+
+	/* read the replay file, check it was recorded in the same world, */
+	/* use its tick rate and return the seed it was recorded with */
+unsigned int readReplay() {
+ReplayHeader header;
+long size;
+FILE *fp;
+
+   if ((fp = fopen(replayFile, "rb")) == NULL) {
+      printf("ERROR: unable to open recording %s\n", replayFile);
+      exit(1);
+   }
+   if ((fread(&header, sizeof(header), 1, fp) != 1) ||
+       (strncmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) != 0)) {
+      printf("ERROR: %s is not a recording\n", replayFile);
+      exit(1);
+   }
+   if (header.version != REPLAY_VERSION) {
+      printf("ERROR: recording %s is version %d, expected version %d\n",
+         replayFile, header.version, REPLAY_VERSION);
+      exit(1);
+   }
+   if ((header.testWorld != testWorld) || (header.x != WORLDX) ||
+       (header.y != WORLDY) || (header.z != WORLDZ)) {
+      printf("ERROR: recording %s was made in a %dx%dx%d %s, replay it with the same world flags\n",
+         replayFile, header.x, header.y, header.z,
+         (header.testWorld == 1) ? "test world" : "maze world");
+      exit(1);
+   }
+   if (header.tickRate < 1) {
+      printf("ERROR: recording %s is damaged\n", replayFile);
+      exit(1);
+   }
+   tickRate = header.tickRate;
+
+   fseek(fp, 0, SEEK_END);
+   size = ftell(fp) - sizeof(header);
+   fseek(fp, sizeof(header), SEEK_SET);
+   replayCount = size / sizeof(ReplayEvent);
+   replayEvent = malloc(sizeof(ReplayEvent) * ((replayCount > 0) ? replayCount : 1));
+   if (replayEvent == NULL) {
+      printf("ERROR: unable to allocate memory for the recording\n");
+      exit(1);
+   }
+   if (fread(replayEvent, sizeof(ReplayEvent), replayCount, fp) !=
+       (size_t) replayCount) {
+      printf("ERROR: unable to read recording %s\n", replayFile);
+      exit(1);
+   }
+   fclose(fp);
+	/* a recording which was cut off ends after its last event */
+   if ((replayCount == 0) || (replayEvent[replayCount - 1].type != REPLAY_END)) {
+      printf("WARNING: recording %s has no end, it stops after the last event\n",
+         replayFile);
+      replayEvent = realloc(replayEvent, sizeof(ReplayEvent) * (replayCount + 1));
+      replayEvent[replayCount].tick =
+         (replayCount > 0) ? replayEvent[replayCount - 1].tick : 0;
+      replayEvent[replayCount].type = REPLAY_END;
+      replayCount++;
+   }
+   return(header.seed);
+}
+
+	/* returns the seed to give srand(), a replay uses the seed it was */
+	/* recorded with and a recording stores the seed in its file */
+unsigned int replaySeed(unsigned int seed) {
+   if ((recordFile != NULL) && (replayFile != NULL)) {
+      printf("ERROR: -record and -replay cannot be used together\n");
+      exit(1);
+   }
+   if (replayFile != NULL)
+      return(readReplay());
+   if (recordFile != NULL)
+      startRecording(seed);
+   return(seed);
+}
+
+	/* pass the events which arrived before tick number simTicks + 1 */
+	/* to the same functions GLUT called when they were recorded */
+void replayInput() {
+ReplayEvent *event;
+
+   while ((replayNext < replayCount) &&
+          (replayEvent[replayNext].tick <= simTicks) &&
+          (replayEvent[replayNext].type != REPLAY_END)) {
+      event = &replayEvent[replayNext++];
+      if (event->type == REPLAY_KEY) {
+		/* quitting ends the recording instead */
+         if ((event->a != 'q') && (event->a != 27))
+            keyboard(event->a, 0, 0);
+      } else if (event->type == REPLAY_LOOK)
+         passivemotion(event->a, event->b);
+      else if (event->type == REPLAY_DRAG)
+         motion(event->a, event->b);
+   }
+}
+
+	/* used by qsort() to put the frame times in order */
+int compareTimes(const void *a, const void *b) {
+double x = *(double *) a, y = *(double *) b;
+   return((x > y) - (x < y));
+}
+
+	/* run the ticks of the recording without a window, time the input */
+	/* update and culling of each tick and print a summary, the time of */
+	/* every tick is written to frameTimesFile when it is given */
+void runReplay() {
+double total[STAGE_COUNT], max[STAGE_COUNT], t[STAGE_COUNT + 1];
+double *frame;
+float x, y, z, mx, my, mz;
+int ticks, tick, s;
+long drawn = 0;
+FILE *fp = NULL;
+
+   ticks = replayEvent[replayCount - 1].tick;
+   frame = malloc(sizeof(double) * ((ticks > 0) ? ticks : 1));
+   if (frame == NULL) {
+      printf("ERROR: unable to allocate memory for the replay\n");
+      exit(1);
+   }
+   if ((frameTimesFile != NULL) && ((fp = fopen(frameTimesFile, "w")) == NULL)) {
+      printf("ERROR: unable to create %s\n", frameTimesFile);
+      exit(1);
+   }
+   if (fp != NULL)
+      fprintf(fp, "tick,input ms,update ms,cull ms,frame ms\n");
+   for(s=0; s<STAGE_COUNT; s++)
+      total[s] = max[s] = 0.0;
+
+   for(tick=0; tick<ticks; tick++) {
+      t[0] = benchClock();
+      replayInput();
+      runQueuedMoves();
+      t[1] = benchClock();
+      simTicks++;
+      profileBegin(PROFILE_UPDATE);
+      update();
+      tickMobs();
+      profileEnd();
+      t[2] = benchClock();
+      buildDisplayList();
+      t[3] = benchClock();
+
+      for(s=0; s<STAGE_COUNT; s++) {
+         total[s] += t[s + 1] - t[s];
+         if (t[s + 1] - t[s] > max[s])
+            max[s] = t[s + 1] - t[s];
+      }
+      frame[tick] = t[3] - t[0];
+      drawn += (meshCubes == 1) ? meshQuadCount : displayCount;
+      if (fp != NULL)
+         fprintf(fp, "%d,%.4f,%.4f,%.4f,%.4f\n", tick + 1, t[1] - t[0],
+            t[2] - t[1], t[3] - t[2], frame[tick]);
+   }
+	/* input which arrived after the last tick */
+   replayInput();
+   runQueuedMoves();
+   if ((fp != NULL) && (ferror(fp) || (fclose(fp) != 0))) {
+      printf("ERROR: unable to write %s\n", frameTimesFile);
+      exit(1);
+   }
+
+   printf("\nReplay: %s, %d ticks at %d per second, %d events, %s\n",
+      replayFile, ticks, tickRate, replayCount - 1,
+      (testWorld == 1) ? "test world" : "maze world");
+   if (streamRadius > 0)
+      printf("WARNING: chunks are streamed in by a thread so the world seen by each tick can differ between runs\n");
+   if (ticks == 0)
+      return;
+   printf("%-12s %10s %10s %12s\n", "stage", "avg ms", "max ms", "total ms");
+   for(s=0; s<STAGE_COUNT; s++)
+      printf("%-12s %10.4f %10.4f %12.2f\n", replayStageName[s],
+         total[s] / ticks, max[s], total[s]);
+   qsort(frame, ticks, sizeof(double), compareTimes);
+   printf("tick ms: median %.4f  95%% %.4f  99%% %.4f  max %.4f\n",
+      frame[ticks / 2], frame[(int) (ticks * 0.95)], frame[(int) (ticks * 0.99)],
+      frame[ticks - 1]);
+   printf("%s per tick: %ld\n", (meshCubes == 1) ? "quads" : "cubes",
+      drawn / ticks);
+	/* the same recording always ends in the same place */
+   getViewPosition(&x, &y, &z);
+   getViewOrientation(&mx, &my, &mz);
+   printf("final viewpoint: %.3f %.3f %.3f  orientation: %.3f %.3f %.3f\n",
+      x, y, z, mx, my, mz);
+   free(frame);
+}
@@ -0,0 +1,336 @@
+/* Saving the world to a file and loading it again. A world file holds */
+/* a header, a table with the position of every chunk which has cubes, */
+/* a block of game state supplied by the caller and then the chunks, */
+/* each with its palette and its indexes run length encoded. Loading */
+/* maps the file into memory and only reads the header, the table and */
+/* the game state. Each chunk is unpacked the first time worldChunkAt() */
+/* is used on it and the file is unmapped once every chunk is unpacked. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "graphics.h"
+
+#define SNAPSHOT_MAGIC "A1WORLD"
+	/* increased whenever the layout of the file changes */
+#define SNAPSHOT_VERSION 1
+	/* order of the cubes inside the chunks, files can only be loaded */
+	/* by a program built with the same layout */
+#ifdef MORTON_LAYOUT
+#define SNAPSHOT_LAYOUT 1
+#else
+#define SNAPSHOT_LAYOUT 0
+#endif
+	/* longest run stored by one pair of bytes */
+#define MAX_RUN 255
+
+extern void worldInit(int, int, int);
+extern int chunkIndexWords(int);
+extern int worldChunkCount;
+
+	/* start of a world file, chunks is the number of entries in the */
+	/* table which follows and stateSize is the bytes of game state */
+	/* after the table */
+typedef struct _SnapshotHeader {
+   char magic[8];
+   int version;
+   int layout;
+   int chunkSize;
+   int x, y, z;
+   int chunks;
+   int stateSize;
+} SnapshotHeader;
+
+	/* chunk is the chunkIndex() of a chunk and offset is where it */
+	/* starts in the file */
+typedef struct _SnapshotEntry {
+   int chunk;
+   unsigned int offset;
+} SnapshotEntry;
+
+	/* start of a chunk in the file, it is followed by colours bytes of */
+	/* palette and length bytes of indexes, the indexes are stored as */
+	/* they are when length is the size of the index array and are run */
+	/* length encoded as pairs of count and byte when it is less */
+typedef struct _SnapshotChunk {
+   int solid;
+   int bits;
+   int colours;
+   int length;
+} SnapshotChunk;
+
+	/* for each chunk the place in the mapped file where it starts, NULL */
+	/* for chunks which are not in the file or have been unpacked */
+unsigned char **worldStored = NULL;
+	/* number of chunks which are still only in the file */
+int worldStoredCount = 0;
+	/* the mapped world file */
+unsigned char *snapshotMap = NULL;
+size_t snapshotMapSize = 0;
+
+	/* copy of the game state read from the last world file loaded */
+void *snapshotState = NULL;
+int snapshotStateSize = 0;
+
+/***********************/
+
+	/* run length encode size bytes from in[] into out[], returns the */
+	/* number of bytes written, out[] must hold 2 * size bytes */
+int encodeRuns(unsigned char *in, int size, unsigned char *out) {
+int i, run, length;
+
+   length = 0;
+   for(i=0; i<size; i+=run) {
+      run = 1;
+      while ((i + run < size) && (run < MAX_RUN) && (in[i + run] == in[i]))
+         run++;
+      out[length++] = run;
+      out[length++] = in[i];
+   }
+   return(length);
+}
+
+	/* expand length bytes of runs from in[] into size bytes of out[] */
+	/* returns 0 if the runs do not fill out[] exactly */
+int decodeRuns(unsigned char *in, int length, unsigned char *out, int size) {
+int i, n;
+
+   n = 0;
+   for(i=0; i+1<length; i+=2) {
+      if (n + in[i] > size)
+         return(0);
+      memset(&out[n], in[i + 1], in[i]);
+      n += in[i];
+   }
+   return(n == size);
+}
+
+	/* unmap the world file once no chunk needs it */
+void closeSnapshot() {
+   munmap(snapshotMap, snapshotMapSize);
+   snapshotMap = NULL;
+   snapshotMapSize = 0;
+   free(worldStored);
+   worldStored = NULL;
+   worldStoredCount = 0;
+}
+
+	/* unpack the chunk which starts at stored in the world file into a */
+	/* new chunk which is not yet part of the world, n is the index of */
+	/* the chunk, this is also called by the streaming loader thread */
+WorldChunk *readStoredChunk(int n, unsigned char *stored) {
+SnapshotChunk *header;
+WorldChunk *chunk;
+unsigned char *palette;
+int size;
+
+   header = (SnapshotChunk *) stored;
+   palette = stored + sizeof(SnapshotChunk);
+   size = sizeof(unsigned int) * chunkIndexWords(header->bits);
+   if ((header->bits < 0) || (header->bits > 8) ||
+       ((header->bits & (header->bits - 1)) != 0) ||
+       (header->colours < 1) || (header->colours > (1 << header->bits)) ||
+       (header->length < 0) || (header->length > size) ||
+       (palette + header->colours + header->length >
+        snapshotMap + snapshotMapSize)) {
+      printf("ERROR: chunk %d in the world file is damaged\n", n);
+      exit(1);
+   }
+
+   chunk = calloc(1, sizeof(WorldChunk));
+   if (chunk != NULL)
+      chunk->index = malloc(size);
+   if ((chunk == NULL) || (chunk->index == NULL)) {
+      printf("ERROR: unable to allocate memory for the world\n");
+      exit(1);
+   }
+   memcpy(chunk->palette, palette, header->colours);
+   chunk->bits = header->bits;
+   chunk->colours = header->colours;
+   chunk->solid = header->solid;
+   if (header->length == size)
+      memcpy(chunk->index, palette + header->colours, size);
+   else if (decodeRuns(palette + header->colours, header->length,
+            (unsigned char *) chunk->index, size) == 0) {
+      printf("ERROR: chunk %d in the world file is damaged\n", n);
+      exit(1);
+   }
+   return(chunk);
+}
+
+	/* unpack chunk n from the world file the first time it is used */
+	/* returns NULL if the chunk is not in the file */
+WorldChunk *touchWorldChunk(int n) {
+   if (worldStored[n] == NULL)
+      return(NULL);
+   worldChunk[n] = readStoredChunk(n, worldStored[n]);
+   worldChunkCount++;
+
+   worldStored[n] = NULL;
+   if (--worldStoredCount == 0)
+      closeSnapshot();
+   return(worldChunk[n]);
+}
+
+	/* write the world and size bytes of game state from state to the */
+	/* file called name */
+void saveWorld(char *name, void *state, int size) {
+SnapshotHeader header;
+SnapshotEntry *table;
+SnapshotChunk stored;
+WorldChunk *chunk;
+unsigned char runs[2 * CHUNK_CUBES], pad[4];
+long offset;
+int n, count, raw;
+FILE *fp;
+
+   count = 0;
+   for(n=0; n<CHUNKX * CHUNKY * CHUNKZ; n++)
+      if (worldChunkAt(n) != NULL)
+         count++;
+   table = malloc(sizeof(SnapshotEntry) * ((count > 0) ? count : 1));
+   if ((fp = fopen(name, "wb")) == NULL) {
+      printf("ERROR: unable to create world file %s\n", name);
+      exit(1);
+   }
+   if (table == NULL) {
+      printf("ERROR: unable to allocate memory for the world file\n");
+      exit(1);
+   }
+
+   memset(&header, 0, sizeof(header));
+   strcpy(header.magic, SNAPSHOT_MAGIC);
+   header.version = SNAPSHOT_VERSION;
+   header.layout = SNAPSHOT_LAYOUT;
+   header.chunkSize = CHUNK_SIZE;
+   header.x = WORLDX;
+   header.y = WORLDY;
+   header.z = WORLDZ;
+   header.chunks = count;
+   header.stateSize = size;
+   memset(pad, 0, sizeof(pad));
+
+	/* the table is written again once the chunk offsets are known */
+   fwrite(&header, sizeof(header), 1, fp);
+   fwrite(table, sizeof(SnapshotEntry), count, fp);
+   if (size > 0)
+      fwrite(state, 1, size, fp);
+
+   count = 0;
+   for(n=0; n<CHUNKX * CHUNKY * CHUNKZ; n++) {
+      chunk = worldChunk[n];
+      if (chunk == NULL)
+         continue;
+		/* chunks start on a 4 byte boundary */
+      offset = ftell(fp);
+      if (offset % 4 != 0) {
+         fwrite(pad, 1, 4 - offset % 4, fp);
+         offset += 4 - offset % 4;
+      }
+      table[count].chunk = n;
+      table[count].offset = offset;
+      count++;
+
+      raw = sizeof(unsigned int) * chunkIndexWords(chunk->bits);
+      stored.solid = chunk->solid;
+      stored.bits = chunk->bits;
+      stored.colours = chunk->colours;
+      stored.length = encodeRuns((unsigned char *) chunk->index, raw, runs);
+      if (stored.length >= raw)
+         stored.length = raw;
+      fwrite(&stored, sizeof(stored), 1, fp);
+      fwrite(chunk->palette, 1, chunk->colours, fp);
+      fwrite((stored.length == raw) ? (unsigned char *) chunk->index : runs,
+         1, stored.length, fp);
+   }
+
+   fseek(fp, sizeof(header), SEEK_SET);
+   fwrite(table, sizeof(SnapshotEntry), count, fp);
+   if (ferror(fp) || (fclose(fp) != 0)) {
+      printf("ERROR: unable to write world file %s\n", name);
+      exit(1);
+   }
+   free(table);
+}
+
+	/* map the world file called name, create a world of the size */
+	/* stored in it and copy its game state into snapshotState, the */
+	/* chunks are left in the file until they are used */
+void loadWorld(char *name) {
+SnapshotHeader *header;
+SnapshotEntry *table;
+struct stat info;
+FILE *fp;
+int i;
+
+	/* the wall state enum in graphics.h hides open() so the file is */
+	/* opened with stdio and mapped through its descriptor */
+   fp = fopen(name, "rb");
+   if ((fp == NULL) || (fstat(fileno(fp), &info) != 0)) {
+      printf("ERROR: unable to open world file %s\n", name);
+      exit(1);
+   }
+   snapshotMapSize = info.st_size;
+   if (snapshotMapSize < sizeof(SnapshotHeader)) {
+      printf("ERROR: %s is not a world file\n", name);
+      exit(1);
+   }
+   snapshotMap = mmap(NULL, snapshotMapSize, PROT_READ, MAP_PRIVATE,
+      fileno(fp), 0);
+   fclose(fp);
+   if (snapshotMap == MAP_FAILED) {
+      printf("ERROR: unable to map world file %s\n", name);
+      exit(1);
+   }
+
+   header = (SnapshotHeader *) snapshotMap;
+   if (strncmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+      printf("ERROR: %s is not a world file\n", name);
+      exit(1);
+   }
+   if ((header->version != SNAPSHOT_VERSION) ||
+       (header->layout != SNAPSHOT_LAYOUT) ||
+       (header->chunkSize != CHUNK_SIZE)) {
+      printf("ERROR: world file %s is version %d layout %d chunk size %d, expected version %d layout %d chunk size %d\n",
+         name, header->version, header->layout, header->chunkSize,
+         SNAPSHOT_VERSION, SNAPSHOT_LAYOUT, CHUNK_SIZE);
+      exit(1);
+   }
+   if ((header->chunks < 0) || (header->stateSize < 0) ||
+       (sizeof(SnapshotHeader) + sizeof(SnapshotEntry) * header->chunks +
+        header->stateSize > snapshotMapSize)) {
+      printf("ERROR: world file %s is damaged\n", name);
+      exit(1);
+   }
+   worldInit(header->x, header->y, header->z);
+
+   table = (SnapshotEntry *) (snapshotMap + sizeof(SnapshotHeader));
+   free(snapshotState);
+   snapshotStateSize = header->stateSize;
+   snapshotState = malloc((snapshotStateSize > 0) ? snapshotStateSize : 1);
+   worldStored = calloc(CHUNKX * CHUNKY * CHUNKZ, sizeof(unsigned char *));
+   if ((snapshotState == NULL) || (worldStored == NULL)) {
+      printf("ERROR: unable to allocate memory for the world\n");
+      exit(1);
+   }
+   memcpy(snapshotState, &table[header->chunks], snapshotStateSize);
+
+   worldStoredCount = 0;
+   for(i=0; i<header->chunks; i++) {
+      if ((table[i].chunk < 0) || (table[i].chunk >= CHUNKX * CHUNKY * CHUNKZ) ||
+          (table[i].offset % 4 != 0) ||
+          (table[i].offset + sizeof(SnapshotChunk) > snapshotMapSize) ||
+          (worldStored[table[i].chunk] != NULL)) {
+         printf("ERROR: world file %s is damaged\n", name);
+         exit(1);
+      }
+      worldStored[table[i].chunk] = snapshotMap + table[i].offset;
+      worldStoredCount++;
+   }
+   if (worldStoredCount == 0)
+      closeSnapshot();
+}
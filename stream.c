@@ -0,0 +1,482 @@
+/* Paging of the world around the viewpoint for worlds loaded with */
+/* -load and -stream. Only the columns of chunks near the viewpoint */
+/* are kept in memory, the rest stay in the mapped world file. A loader */
+/* thread reads the chunks which are wanted and updateStreaming(), */
+/* called once a frame, adds the chunks it has finished to the world, */
+/* asks for the chunks near the viewpoint and near where the viewpoint */
+/* is heading, and removes the chunks which have gone unused the longest */
+/* once more than streamBudget are in memory. Chunks which are not in */
+/* memory are empty to the rest of the program so nothing waits for the */
+/* loader. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "graphics.h"
+
+	/* largest number of chunks waiting to be read or added */
+#define STREAM_QUEUE 1024
+	/* most chunks added to or removed from the world each frame */
+#define STREAM_INSTALL 8
+#define STREAM_EVICT 8
+	/* milliseconds ahead of the viewpoint the prefetch looks using the */
+	/* current velocity */
+#define STREAM_LOOKAHEAD 1000.0
+
+	/* state of each chunk in the world file */
+#define STREAM_OUT 0
+#define STREAM_PENDING 1
+#define STREAM_RESIDENT 2
+#define STREAM_CHANGED 3
+
+extern void getViewPosition(float *, float *, float *);
+extern int getElapsedTime();
+extern void octreeUpdate(int, int, int, int, int);
+extern void updateSurface(int, int, int, int, int, int);
+extern void addDirtyBox(int, int, int, int, int, int);
+extern void invalidateColumns(int, int, int, int);
+extern void unpackWorldChunk(WorldChunk *, GLubyte *);
+extern WorldChunk *readStoredChunk(int, unsigned char *);
+extern double benchClock();
+
+extern int worldChunkCount;
+extern int worldStoredCount;
+extern int surfaceInit;
+
+	/* radius in columns of chunks kept around the viewpoint, 0 when the */
+	/* world is not streamed, and the most unchanged chunks kept in memory */
+extern int streamRadius;
+extern int streamBudget;
+	/* file of chunk checksums written or compared by checkChunks() */
+extern char *chunkCheckFile;
+
+	/* place of each chunk in the mapped world file, NULL if the chunk */
+	/* is empty, and the state of each chunk */
+unsigned char **streamSource = NULL;
+char *streamState = NULL;
+	/* when each chunk was asked for and the last frame it was near the */
+	/* viewpoint */
+double *streamRequested = NULL;
+int *streamUsed = NULL;
+int streamFrame = 0;
+
+	/* chunks in memory which can be removed, most recently used first */
+int *lruPrev = NULL;
+int *lruNext = NULL;
+int lruHead = -1;
+int lruTail = -1;
+int lruCount = 0;
+
+	/* chunks waiting for the loader and chunks it has finished, both */
+	/* are rings indexed by counters which only increase */
+pthread_t streamThread;
+pthread_mutex_t streamLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t streamWake = PTHREAD_COND_INITIALIZER;
+int requestChunk[STREAM_QUEUE];
+int requestHead = 0, requestTail = 0;
+int loadedChunk[STREAM_QUEUE];
+WorldChunk *loadedData[STREAM_QUEUE];
+int loadedHead = 0, loadedTail = 0;
+	/* chunks asked for and not yet added to the world */
+int streamPending = 0;
+
+	/* last viewpoint and time used to find the velocity */
+float streamX, streamZ;
+int streamTime;
+
+	/* statistics printed by printStreamStats() */
+long streamLoads = 0;
+long streamWriteLoads = 0;
+long streamEvictions = 0;
+int streamChanged = 0;
+int streamPeak = 0;
+double streamLatency = 0.0;
+double streamLatencyMax = 0.0;
+
+/***********************/
+
+	/* remove chunk n from the list of chunks which can be removed */
+void lruRemove(int n) {
+   if (lruPrev[n] != -1)
+      lruNext[lruPrev[n]] = lruNext[n];
+   else
+      lruHead = lruNext[n];
+   if (lruNext[n] != -1)
+      lruPrev[lruNext[n]] = lruPrev[n];
+   else
+      lruTail = lruPrev[n];
+   lruCount--;
+}
+
+	/* put chunk n at the front of the list as the most recently used */
+void lruPush(int n) {
+   lruPrev[n] = -1;
+   lruNext[n] = lruHead;
+   if (lruHead != -1)
+      lruPrev[lruHead] = n;
+   lruHead = n;
+   if (lruTail == -1)
+      lruTail = n;
+   lruCount++;
+}
+
+	/* the loader thread reads the chunks in the request ring */
+void *streamLoader(void *arg) {
+WorldChunk *chunk;
+int n;
+
+   (void) arg;
+   while (1) {
+      pthread_mutex_lock(&streamLock);
+      while (requestHead == requestTail)
+         pthread_cond_wait(&streamWake, &streamLock);
+      n = requestChunk[requestHead % STREAM_QUEUE];
+      requestHead++;
+      pthread_mutex_unlock(&streamLock);
+
+      chunk = readStoredChunk(n, streamSource[n]);
+
+      pthread_mutex_lock(&streamLock);
+      loadedChunk[loadedTail % STREAM_QUEUE] = n;
+      loadedData[loadedTail % STREAM_QUEUE] = chunk;
+      loadedTail++;
+      pthread_mutex_unlock(&streamLock);
+   }
+   return(NULL);
+}
+
+	/* find the box of cubes covered by chunk n, clipped to the world */
+void chunkBox(int n, int box[6]) {
+   box[2] = (n % CHUNKZ) * CHUNK_SIZE;
+   box[1] = ((n / CHUNKZ) % CHUNKY) * CHUNK_SIZE;
+   box[0] = (n / (CHUNKZ * CHUNKY)) * CHUNK_SIZE;
+   box[3] = (box[0] + CHUNK_SIZE < WORLDX) ? box[0] + CHUNK_SIZE : WORLDX;
+   box[4] = (box[1] + CHUNK_SIZE < WORLDY) ? box[1] + CHUNK_SIZE : WORLDY;
+   box[5] = (box[2] + CHUNK_SIZE < WORLDZ) ? box[2] + CHUNK_SIZE : WORLDZ;
+}
+
+	/* add dsolid to the octree for every cube in chunk n and take away */
+	/* its exposed cubes when dsolid is -1, the new exposed cubes are */
+	/* added by updateSurface() */
+void countChunk(int n, WorldChunk *chunk, int dsolid) {
+GLubyte cell[CHUNK_CUBES];
+int box[6], x, y, z, s;
+
+   if (surfaceInit == 0)
+      return;
+   chunkBox(n, box);
+   unpackWorldChunk(chunk, cell);
+   for(x=box[0]; x<box[3]; x++)
+      for(y=box[1]; y<box[4]; y++)
+         for(z=box[2]; z<box[5]; z++) {
+            s = surfaceIndex(x, y, z);
+            if ((dsolid == -1) && ((chunk->surface[s / 64] >> (s % 64)) & 1))
+               octreeUpdate(x, y, z, 0, -1);
+            if (cell[cubeIndex(x, y, z)] != 0)
+               octreeUpdate(x, y, z, dsolid, 0);
+         }
+}
+
+	/* add chunk n read by the loader to the world */
+void installChunk(int n, WorldChunk *chunk) {
+int box[6];
+
+	/* a chunk read at once by streamBeforeWrite() or replaced by */
+	/* fillWorldChunk() while this copy was being read is already in */
+	/* the world and keeps its state */
+   if (worldChunk[n] != NULL) {
+      free(chunk->index);
+      free(chunk);
+      return;
+   }
+   worldChunk[n] = chunk;
+   worldChunkCount++;
+   streamState[n] = STREAM_RESIDENT;
+   lruPush(n);
+   if (lruCount + streamChanged > streamPeak)
+      streamPeak = lruCount + streamChanged;
+
+   countChunk(n, chunk, 1);
+   chunkBox(n, box);
+   updateSurface(box[0], box[1], box[2], box[3], box[4], box[5]);
+   invalidateColumns(box[0], box[2], box[3], box[5]);
+   addDirtyBox(box[0], box[1], box[2], box[3], box[4], box[5]);
+}
+
+	/* called before the cubes of chunk n are changed, a chunk which is */
+	/* in the file but not in memory is read at once so the change is */
+	/* made to its cubes, otherwise the change would create an almost */
+	/* empty chunk which hides the one in the file */
+void streamBeforeWrite(int n) {
+   if ((streamSource == NULL) || (worldChunk[n] != NULL) ||
+       (streamSource[n] == NULL))
+      return;
+   installChunk(n, readStoredChunk(n, streamSource[n]));
+   streamUsed[n] = streamFrame;
+   streamWriteLoads++;
+}
+
+	/* remove chunk n from the world, it can be read again from the file */
+void evictChunk(int n) {
+WorldChunk *chunk;
+int box[6];
+
+   chunk = worldChunk[n];
+   countChunk(n, chunk, -1);
+   free(chunk->index);
+   free(chunk);
+   worldChunk[n] = NULL;
+   worldChunkCount--;
+   streamState[n] = STREAM_OUT;
+   streamEvictions++;
+
+	/* the cubes next to the chunk are now exposed */
+   chunkBox(n, box);
+   updateSurface(box[0], box[1], box[2], box[3], box[4], box[5]);
+   invalidateColumns(box[0], box[2], box[3], box[5]);
+   addDirtyBox(box[0], box[1], box[2], box[3], box[4], box[5]);
+}
+
+	/* ask for the columns of chunks within streamRadius of chunk cx,cz */
+	/* which are not in memory, nearest first, and mark the chunks which */
+	/* are in memory as used, when wait is 1 the chunks are read at once */
+	/* whole columns are kept since the world is much wider than it is */
+	/* high and the ground below the viewpoint must always be there */
+void streamAround(int cx, int cz, int wait) {
+int d, x, y, z, n;
+
+   for(d=0; d<=streamRadius; d++)
+      for(x=cx-d; x<=cx+d; x++)
+         for(z=cz-d; z<=cz+d; z++) {
+		/* only the ring of columns at distance d */
+            if ((abs(x - cx) != d) && (abs(z - cz) != d))
+               continue;
+            if ((x < 0) || (z < 0) || (x >= CHUNKX) || (z >= CHUNKZ))
+               continue;
+            for(y=0; y<CHUNKY; y++) {
+               n = chunkIndex(x, y, z);
+               if (streamState[n] == STREAM_RESIDENT) {
+                  if (lruHead != n) {
+                     lruRemove(n);
+                     lruPush(n);
+                  }
+                  streamUsed[n] = streamFrame;
+               } else if ((streamState[n] == STREAM_OUT) &&
+                          (worldChunk[n] == NULL) &&
+                          (streamSource[n] != NULL)) {
+                  if (wait == 1) {
+                     installChunk(n, readStoredChunk(n, streamSource[n]));
+                     streamUsed[n] = streamFrame;
+                  } else if (streamPending < STREAM_QUEUE) {
+                     streamState[n] = STREAM_PENDING;
+                     streamRequested[n] = benchClock();
+                     streamPending++;
+                     pthread_mutex_lock(&streamLock);
+                     requestChunk[requestTail % STREAM_QUEUE] = n;
+                     requestTail++;
+                     pthread_cond_signal(&streamWake);
+                     pthread_mutex_unlock(&streamLock);
+                  }
+               }
+            }
+         }
+}
+
+	/* take over the chunks of the loaded world file, read the chunks */
+	/* around the starting viewpoint and start the loader thread */
+void streamInit() {
+float x;
+int total, n;
+
+   total = CHUNKX * CHUNKY * CHUNKZ;
+   streamSource = worldStored;
+   if (streamSource == NULL)
+      streamSource = calloc(total, sizeof(unsigned char *));
+	/* chunks now only reach the world through updateStreaming() */
+   worldStored = NULL;
+   worldStoredCount = 0;
+
+   streamState = calloc(total, sizeof(char));
+   streamRequested = calloc(total, sizeof(double));
+   streamUsed = calloc(total, sizeof(int));
+   lruPrev = malloc(total * sizeof(int));
+   lruNext = malloc(total * sizeof(int));
+   if ((streamSource == NULL) || (streamState == NULL) ||
+       (streamRequested == NULL) || (streamUsed == NULL) ||
+       (lruPrev == NULL) || (lruNext == NULL)) {
+      printf("ERROR: unable to allocate memory for streaming the world\n");
+      exit(1);
+   }
+   for(n=0; n<total; n++)
+      lruPrev[n] = lruNext[n] = -1;
+
+   getViewPosition(&streamX, &x, &streamZ);
+   streamTime = getElapsedTime();
+   streamAround((int) -streamX / CHUNK_SIZE, (int) -streamZ / CHUNK_SIZE, 1);
+
+   if (pthread_create(&streamThread, NULL, streamLoader, NULL) != 0) {
+      printf("ERROR: unable to create the world loader thread\n");
+      exit(1);
+   }
+}
+
+	/* called once a frame before the world is drawn, adds the chunks */
+	/* which have been read, asks for the chunks around the viewpoint */
+	/* and where it will be in STREAM_LOOKAHEAD ms and removes the */
+	/* least recently used chunks when there are too many */
+void updateStreaming() {
+int chunk[STREAM_INSTALL];
+WorldChunk *data[STREAM_INSTALL];
+float x, y, z, vx, vz;
+int i, count, n, now, evicted, cx, cz, ax, az;
+double latency;
+
+   if (streamRadius == 0)
+      return;
+   streamFrame++;
+
+	/* add the chunks the loader has finished */
+   pthread_mutex_lock(&streamLock);
+   for(count=0; (count<STREAM_INSTALL) && (loadedHead != loadedTail); count++) {
+      chunk[count] = loadedChunk[loadedHead % STREAM_QUEUE];
+      data[count] = loadedData[loadedHead % STREAM_QUEUE];
+      loadedHead++;
+   }
+   pthread_mutex_unlock(&streamLock);
+   for(i=0; i<count; i++) {
+      latency = benchClock() - streamRequested[chunk[i]];
+      streamLatency += latency;
+      if (latency > streamLatencyMax)
+         streamLatencyMax = latency;
+      streamLoads++;
+      streamPending--;
+      installChunk(chunk[i], data[i]);
+   }
+
+	/* velocity in cubes per millisecond, the viewpoint is negated */
+   getViewPosition(&x, &y, &z);
+   now = getElapsedTime();
+   vx = vz = 0.0;
+   if (now > streamTime) {
+      vx = (streamX - x) / (now - streamTime);
+      vz = (streamZ - z) / (now - streamTime);
+   }
+   streamX = x;
+   streamZ = z;
+   streamTime = now;
+
+   cx = (int) -x / CHUNK_SIZE;
+   cz = (int) -z / CHUNK_SIZE;
+   streamAround(cx, cz, 0);
+   ax = (int) (-x + vx * STREAM_LOOKAHEAD) / CHUNK_SIZE;
+   az = (int) (-z + vz * STREAM_LOOKAHEAD) / CHUNK_SIZE;
+   if ((ax != cx) || (az != cz))
+      streamAround(ax, az, 0);
+
+	/* remove the least recently used chunks which were not near the */
+	/* viewpoint this frame, changed chunks are kept since the file */
+	/* does not hold their new cubes */
+   evicted = 0;
+   while ((lruCount > streamBudget) && (evicted < STREAM_EVICT)) {
+      n = lruTail;
+      if (streamUsed[n] == streamFrame)
+         break;
+      lruRemove(n);
+      if (worldChunk[n]->changed == 1) {
+         streamState[n] = STREAM_CHANGED;
+         streamChanged++;
+         continue;
+      }
+      evictChunk(n);
+      evicted++;
+   }
+}
+
+	/* print the number of chunks in memory and how long they took to */
+	/* arrive after they were asked for */
+void printStreamStats() {
+   if (streamRadius == 0)
+      return;
+   printf("streaming: %d chunks in memory (%d changed, peak %d), %d waiting, %ld read, %ld read to change, %ld removed\n",
+      lruCount + streamChanged, streamChanged, streamPeak, streamPending,
+      streamLoads, streamWriteLoads, streamEvictions);
+   printf("streaming latency: average %.3f ms, max %.3f ms\n",
+      (streamLoads > 0) ? streamLatency / streamLoads : 0.0, streamLatencyMax);
+}
+
+	/* checksum of the cubes of a chunk, a chunk which is not */
+	/* allocated is all empty cubes */
+unsigned int chunkSum(WorldChunk *chunk) {
+GLubyte cube[CHUNK_CUBES];
+unsigned int sum;
+int i;
+
+   if (chunk == NULL)
+      memset(cube, 0, CHUNK_CUBES);
+   else
+      unpackWorldChunk(chunk, cube);
+   sum = 2166136261u;
+   for(i=0; i<CHUNK_CUBES; i++)
+      sum = (sum ^ cube[i]) * 16777619u;
+   return(sum);
+}
+
+	/* run at the end of the benchmark with -chunkcheck, without -stream */
+	/* it writes the checksum of every chunk to chunkCheckFile, with */
+	/* -stream it compares the chunks in memory against the file so a */
+	/* streamed run can be checked against one which was not streamed */
+void checkChunks() {
+FILE *fp;
+unsigned int *sum, value;
+int total, n, resident, differ;
+
+   if (chunkCheckFile == NULL)
+      return;
+   total = CHUNKX * CHUNKY * CHUNKZ;
+   if (streamRadius == 0) {
+      if ((fp = fopen(chunkCheckFile, "wb")) == NULL) {
+         printf("ERROR: unable to create %s\n", chunkCheckFile);
+         exit(1);
+      }
+      for(n=0; n<total; n++) {
+         value = chunkSum(worldChunkAt(n));
+         fwrite(&value, sizeof(unsigned int), 1, fp);
+      }
+      if (ferror(fp) || (fclose(fp) != 0)) {
+         printf("ERROR: unable to write %s\n", chunkCheckFile);
+         exit(1);
+      }
+      printf("chunk check: wrote %d chunk checksums to %s\n", total,
+         chunkCheckFile);
+      return;
+   }
+
+   sum = malloc(total * sizeof(unsigned int));
+   if (sum == NULL) {
+      printf("ERROR: unable to allocate memory for the chunk check\n");
+      exit(1);
+   }
+   if (((fp = fopen(chunkCheckFile, "rb")) == NULL) ||
+       (fread(sum, sizeof(unsigned int), total, fp) != (size_t) total)) {
+      printf("ERROR: %s does not hold the checksums of a %dx%dx%d world\n",
+         chunkCheckFile, WORLDX, WORLDY, WORLDZ);
+      exit(1);
+   }
+   fclose(fp);
+   resident = differ = 0;
+   for(n=0; n<total; n++) {
+      if (worldChunk[n] == NULL)
+         continue;
+      resident++;
+      if (chunkSum(worldChunk[n]) != sum[n]) {
+         if (differ < 10)
+            printf("chunk check: chunk %d differs from the run without -stream\n", n);
+         differ++;
+      }
+   }
+   printf("chunk check: %d chunks in memory, %d differ from the run without -stream\n",
+      resident, differ);
+   free(sum);
+}
@@ -0,0 +1,517 @@
+/* Storage for the world and the functions used to change it. The world */
+/* is kept in chunks which are only allocated while they hold a cube. */
+/* Every change is recorded as a dirty box so the cached geometry for */
+/* the chunks which changed can be updated without recalculating */
+/* everything. The index of exposed cubes and the octree used for */
+/* culling are updated as each cube is changed, as are the solid runs */
+/* of each column in heightmap.c. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics.h"
+
+	/* maximum number of separate boxes recorded each frame, when */
+	/* there are more the new box is merged into an existing one */
+#define MAX_DIRTY_BOXES 64
+
+extern void dirtyChunkMesh(int, int, int);
+extern void dirtyOccluders(int, int, int, int);
+extern void dirtyFlowField(int, int, int, int);
+extern void octreeInit();
+extern void octreeUpdate(int, int, int, int, int);
+extern void updateColumn(int, int, int, int);
+extern void invalidateColumns(int, int, int, int);
+extern void streamBeforeWrite(int);
+
+	/* area of the world which changed, b is the bottom corner and */
+	/* t is one past the top corner */
+typedef struct _DirtyBox {
+   int bx, by, bz;
+   int tx, ty, tz;
+} DirtyBox;
+
+DirtyBox dirtyBox[MAX_DIRTY_BOXES];
+int dirtyCount = 0;
+
+	/* number of chunks marked as changed by the last flushWorldDirty() */
+int dirtyChunkCount = 0;
+
+	/* size of the world in cubes */
+int worldX = 100, worldY = 50, worldZ = 100;
+	/* chunks of the world, NULL where a chunk has no cubes */
+WorldChunk **worldChunk = NULL;
+	/* number of chunks which are allocated */
+int worldChunkCount = 0;
+
+	/* set when the surface bits in each chunk and the octree match */
+	/* the world */
+int surfaceInit = 0;
+
+/***********************/
+
+	/* allocate the table of chunks for a world of x by y by z cubes */
+	/* every chunk starts out empty */
+void worldInit(int x, int y, int z) {
+   if ((x < 1) || (y < 1) || (z < 1) ||
+       (x > MAX_WORLDX) || (y > MAX_WORLDY) || (z > MAX_WORLDZ)) {
+      printf("ERROR: the world must be from 1x1x1 to %dx%dx%d cubes\n",
+         MAX_WORLDX, MAX_WORLDY, MAX_WORLDZ);
+      exit(1);
+   }
+   worldX = x;
+   worldY = y;
+   worldZ = z;
+   worldChunk = calloc(CHUNKX * CHUNKY * CHUNKZ, sizeof(WorldChunk *));
+   if (worldChunk == NULL) {
+      printf("ERROR: unable to allocate memory for the world\n");
+      exit(1);
+   }
+}
+
+	/* returns the cube at x,y,z, positions outside the world and */
+	/* in chunks which are not allocated are empty */
+GLubyte getWorldCube(int x, int y, int z) {
+WorldChunk *chunk;
+
+   if ((x < 0) || (y < 0) || (z < 0) ||
+       (x >= WORLDX) || (y >= WORLDY) || (z >= WORLDZ))
+      return(0);
+   chunk = worldChunkAt(chunkIndex(x / CHUNK_SIZE, y / CHUNK_SIZE, z / CHUNK_SIZE));
+   if (chunk == NULL)
+      return(0);
+   return(chunkCube(chunk, cubeIndex(x, y, z)));
+}
+
+	/* returns the number of 32 bit words holding the indexes of a */
+	/* chunk with the given bits per cube */
+int chunkIndexWords(int bits) {
+   return((bits == 0) ? 1 : CHUNK_CUBES * bits / 32);
+}
+
+	/* returns the chunk holding the cube at x,y,z inside the world */
+	/* allocating it filled with value if it is empty */
+WorldChunk *allocWorldChunk(int x, int y, int z, GLubyte value) {
+WorldChunk **chunk;
+
+   chunk = &worldChunk[chunkIndex(x / CHUNK_SIZE, y / CHUNK_SIZE, z / CHUNK_SIZE)];
+   if (*chunk == NULL) {
+      *chunk = calloc(1, sizeof(WorldChunk));
+      if (*chunk != NULL)
+         (*chunk)->index = calloc(chunkIndexWords(0), sizeof(unsigned int));
+      if ((*chunk == NULL) || ((*chunk)->index == NULL)) {
+         printf("ERROR: unable to allocate memory for the world\n");
+         exit(1);
+      }
+      (*chunk)->palette[0] = value;
+      (*chunk)->colours = 1;
+      worldChunkCount++;
+   }
+   return(*chunk);
+}
+
+	/* free the chunks which hold part of the box from bx,by,bz up to */
+	/* but not including tx,ty,tz and no longer contain any cubes */
+void releaseWorldChunks(int bx, int by, int bz, int tx, int ty, int tz) {
+int x, y, z, n;
+
+   for(x=bx/CHUNK_SIZE; x*CHUNK_SIZE<tx; x++)
+      for(y=by/CHUNK_SIZE; y*CHUNK_SIZE<ty; y++)
+         for(z=bz/CHUNK_SIZE; z*CHUNK_SIZE<tz; z++) {
+            n = chunkIndex(x, y, z);
+            if ((worldChunk[n] != NULL) && (worldChunk[n]->solid == 0)) {
+               free(worldChunk[n]->index);
+               free(worldChunk[n]);
+               worldChunk[n] = NULL;
+               worldChunkCount--;
+            }
+         }
+}
+
+	/* store palette entry p as the index of cube n in a chunk */
+void setChunkIndex(WorldChunk *chunk, int n, int p) {
+unsigned int *word, shift, mask;
+
+   if (chunk->bits == 0)
+      return;
+   word = &chunk->index[(n * chunk->bits) >> 5];
+   shift = (n * chunk->bits) & 31;
+   mask = ((1u << chunk->bits) - 1) << shift;
+   *word = (*word & ~mask) | ((unsigned int) p << shift);
+}
+
+	/* copy the indexes of a chunk into a new array with bits per cube */
+void repackWorldChunk(WorldChunk *chunk, int bits) {
+unsigned int *index, *old;
+int n, p, oldBits;
+
+   index = calloc(chunkIndexWords(bits), sizeof(unsigned int));
+   if (index == NULL) {
+      printf("ERROR: unable to allocate memory for the world\n");
+      exit(1);
+   }
+   old = chunk->index;
+   oldBits = chunk->bits;
+   chunk->index = index;
+   chunk->bits = bits;
+   if (oldBits > 0)
+      for(n=0; n<CHUNK_CUBES; n++) {
+         p = (old[(n * oldBits) >> 5] >> ((n * oldBits) & 31))
+            & ((1u << oldBits) - 1);
+         setChunkIndex(chunk, n, p);
+      }
+   free(old);
+}
+
+	/* returns the palette entry for value in a chunk, a new entry */
+	/* replaces one which is no longer used before the indexes are */
+	/* widened to make room */
+int chunkPaletteEntry(WorldChunk *chunk, GLubyte value) {
+int used[256];
+int p, n;
+
+   for(p=0; p<chunk->colours; p++)
+      if (chunk->palette[p] == value)
+         return(p);
+
+   if ((chunk->bits > 0) && (chunk->colours == (1 << chunk->bits))) {
+      memset(used, 0, sizeof(used));
+      for(n=0; n<CHUNK_CUBES; n++)
+         used[(chunk->index[(n * chunk->bits) >> 5]
+            >> ((n * chunk->bits) & 31)) & ((1 << chunk->bits) - 1)] = 1;
+      for(p=0; p<chunk->colours; p++)
+         if (used[p] == 0) {
+            chunk->palette[p] = value;
+            return(p);
+         }
+   }
+
+   if (chunk->colours == (1 << chunk->bits))
+      repackWorldChunk(chunk, (chunk->bits == 0) ? 1 : chunk->bits * 2);
+   chunk->palette[chunk->colours] = value;
+   return(chunk->colours++);
+}
+
+	/* store value in the cube at x,y,z inside the world and keep the */
+	/* count of non empty cubes in its chunk, returns the old value */
+GLubyte putWorldCube(int x, int y, int z, GLubyte value) {
+WorldChunk *chunk;
+GLubyte old;
+int n;
+
+   chunk = worldChunkAt(chunkIndex(x / CHUNK_SIZE, y / CHUNK_SIZE, z / CHUNK_SIZE));
+   if (chunk == NULL) {
+      if (value == 0)
+         return(0);
+      chunk = allocWorldChunk(x, y, z, 0);
+   }
+   n = cubeIndex(x, y, z);
+   old = chunkCube(chunk, n);
+   if (old == value)
+      return(old);
+   setChunkIndex(chunk, n, chunkPaletteEntry(chunk, value));
+   chunk->solid += (value != 0) - (old != 0);
+   chunk->changed = 1;
+   return(old);
+}
+
+	/* copy the cubes of a chunk into cube[] in cubeIndex() order */
+void unpackWorldChunk(WorldChunk *chunk, GLubyte cube[CHUNK_CUBES]) {
+unsigned int word, mask;
+int n, i, per;
+
+   if (chunk->bits == 0) {
+      memset(cube, chunk->palette[0], CHUNK_CUBES);
+      return;
+   }
+   mask = (1u << chunk->bits) - 1;
+   per = 32 / chunk->bits;
+   for(n=0; n<CHUNK_CUBES; n+=per) {
+      word = chunk->index[n / per];
+      for(i=0; i<per; i++) {
+         cube[n + i] = chunk->palette[word & mask];
+         word >>= chunk->bits;
+      }
+   }
+}
+
+	/* set every cube in the chunk holding x,y,z to value without */
+	/* looking at the cubes which were there */
+void fillWorldChunk(int x, int y, int z, GLubyte value) {
+WorldChunk *chunk;
+
+   chunk = allocWorldChunk(x, y, z, value);
+   if (chunk->bits > 0)
+      repackWorldChunk(chunk, 0);
+   chunk->palette[0] = value;
+   chunk->colours = 1;
+   chunk->solid = (value == 0) ? 0 : CHUNK_CUBES;
+   chunk->changed = 1;
+}
+
+	/* memory used by the world, the table of chunks and every chunk */
+	/* which is allocated, bits[] counts the chunks with each index size */
+long worldMemory(int bits[9]) {
+WorldChunk *chunk;
+long bytes;
+int n;
+
+   bytes = sizeof(WorldChunk *) * CHUNKX * CHUNKY * CHUNKZ;
+   for(n=0; n<9; n++)
+      bits[n] = 0;
+   for(n=0; n<CHUNKX * CHUNKY * CHUNKZ; n++) {
+      chunk = worldChunk[n];
+      if (chunk == NULL)
+         continue;
+      bits[chunk->bits]++;
+      bytes += sizeof(WorldChunk) + sizeof(unsigned int) * chunkIndexWords(chunk->bits);
+   }
+   return(bytes);
+}
+
+	/* returns 1 if the boxes overlap or touch each other */
+int boxesTouch(DirtyBox *a, DirtyBox *b) {
+   return((a->bx <= b->tx) && (b->bx <= a->tx) &&
+          (a->by <= b->ty) && (b->by <= a->ty) &&
+          (a->bz <= b->tz) && (b->bz <= a->tz));
+}
+
+	/* grow box a so it also contains box b */
+void mergeBox(DirtyBox *a, DirtyBox *b) {
+   if (b->bx < a->bx) a->bx = b->bx;
+   if (b->by < a->by) a->by = b->by;
+   if (b->bz < a->bz) a->bz = b->bz;
+   if (b->tx > a->tx) a->tx = b->tx;
+   if (b->ty > a->ty) a->ty = b->ty;
+   if (b->tz > a->tz) a->tz = b->tz;
+}
+
+	/* record that the cubes from bx,by,bz up to but not including */
+	/* tx,ty,tz have changed */
+void addDirtyBox(int bx, int by, int bz, int tx, int ty, int tz) {
+DirtyBox box;
+int i;
+
+   box.bx = bx;  box.by = by;  box.bz = bz;
+   box.tx = tx;  box.ty = ty;  box.tz = tz;
+
+	/* cubes changed one after another usually touch a box which */
+	/* has already been recorded */
+   for(i=dirtyCount-1; i>=0; i--)
+      if (boxesTouch(&dirtyBox[i], &box)) {
+         mergeBox(&dirtyBox[i], &box);
+         return;
+      }
+
+   if (dirtyCount == MAX_DIRTY_BOXES)
+      mergeBox(&dirtyBox[dirtyCount-1], &box);
+   else
+      dirtyBox[dirtyCount++] = box;
+}
+
+	/* returns 1 if the cube at i,j,k can be seen from outside, it */
+	/* is not empty and is either on the edge of the world or */
+	/* not surrounded by 6 neighbours */
+int cubeExposed(int i, int j, int k) {
+   if (getWorldCube(i, j, k) == 0)
+      return(0);
+   if ( (i == 0) || (i == WORLDX-1) ||
+        (j == 0) || (j == WORLDY-1) ||
+        (k == 0) || (k == WORLDZ-1) )
+      return(1);
+   return((getWorldCube(i+1, j, k) == 0) || (getWorldCube(i-1, j, k) == 0)
+       || (getWorldCube(i, j+1, k) == 0) || (getWorldCube(i, j-1, k) == 0)
+       || (getWorldCube(i, j, k+1) == 0) || (getWorldCube(i, j, k-1) == 0));
+}
+
+	/* recalculate the exposed bit for the cubes from bx,by,bz up to */
+	/* but not including tx,ty,tz and the cubes around them */
+void updateSurface(int bx, int by, int bz, int tx, int ty, int tz) {
+int x, y, z, n, exposed;
+unsigned long long *word, bit;
+WorldChunk *chunk;
+
+   if (surfaceInit == 0)
+      return;
+   if (--bx < 0) bx = 0;
+   if (--by < 0) by = 0;
+   if (--bz < 0) bz = 0;
+   if (++tx > WORLDX) tx = WORLDX;
+   if (++ty > WORLDY) ty = WORLDY;
+   if (++tz > WORLDZ) tz = WORLDZ;
+
+   for(x=bx; x<tx; x++)
+      for(y=by; y<ty; y++)
+         for(z=bz; z<tz; z++) {
+		/* an empty chunk has no exposed cubes */
+            chunk = worldChunkAt(chunkIndex(x / CHUNK_SIZE, y / CHUNK_SIZE,
+               z / CHUNK_SIZE));
+            if (chunk == NULL)
+               continue;
+            n = surfaceIndex(x, y, z);
+            word = &chunk->surface[n / 64];
+            bit = 1ULL << (n % 64);
+            exposed = cubeExposed(x, y, z);
+            if ((exposed == 1) && ((*word & bit) == 0)) {
+               *word |= bit;
+               octreeUpdate(x, y, z, 0, 1);
+            } else if ((exposed == 0) && ((*word & bit) != 0)) {
+               *word &= ~bit;
+               octreeUpdate(x, y, z, 0, -1);
+            }
+         }
+}
+
+	/* build the exposed cube index and the octree for the whole world */
+	/* the first time they are needed, this picks up changes made */
+	/* before the first frame, after that the world changing functions */
+	/* keep them current, only the allocated chunks are visited and */
+	/* chunks still in a loaded world file are unpacked */
+void buildSurfaceIndex() {
+int cx, cy, cz, x, y, z;
+WorldChunk *chunk;
+
+   if (surfaceInit == 1)
+      return;
+   octreeInit();
+   for(cx=0; cx<CHUNKX; cx++)
+      for(cy=0; cy<CHUNKY; cy++)
+         for(cz=0; cz<CHUNKZ; cz++) {
+            chunk = worldChunkAt(chunkIndex(cx, cy, cz));
+            if (chunk == NULL)
+               continue;
+            memset(chunk->surface, 0, sizeof(chunk->surface));
+            for(x=cx*CHUNK_SIZE; (x<(cx+1)*CHUNK_SIZE) && (x<WORLDX); x++)
+               for(y=cy*CHUNK_SIZE; (y<(cy+1)*CHUNK_SIZE) && (y<WORLDY); y++)
+                  for(z=cz*CHUNK_SIZE; (z<(cz+1)*CHUNK_SIZE) && (z<WORLDZ); z++)
+                     if (chunkCube(chunk, cubeIndex(x, y, z)) != 0)
+                        octreeUpdate(x, y, z, 1, 0);
+         }
+   surfaceInit = 1;
+   for(cx=0; cx<CHUNKX; cx++)
+      for(cy=0; cy<CHUNKY; cy++)
+         for(cz=0; cz<CHUNKZ; cz++)
+            if (worldChunk[chunkIndex(cx, cy, cz)] != NULL)
+               updateSurface(cx * CHUNK_SIZE, cy * CHUNK_SIZE, cz * CHUNK_SIZE,
+                  (cx + 1) * CHUNK_SIZE, (cy + 1) * CHUNK_SIZE,
+                  (cz + 1) * CHUNK_SIZE);
+}
+
+	/* adjust the count of non empty cubes in the octree when the */
+	/* cube at x,y,z changes from old to value */
+void updateSolid(int x, int y, int z, GLubyte old, GLubyte value) {
+   if ((surfaceInit == 0) || ((old == 0) == (value == 0)))
+      return;
+   octreeUpdate(x, y, z, (value == 0) ? -1 : 1, 0);
+}
+
+	/* set the cube at x,y,z to value, positions outside the world */
+	/* are ignored */
+void setWorldCube(int x, int y, int z, GLubyte value) {
+GLubyte old;
+
+   if ((x < 0) || (y < 0) || (z < 0) ||
+       (x >= WORLDX) || (y >= WORLDY) || (z >= WORLDZ))
+      return;
+   streamBeforeWrite(chunkIndex(x / CHUNK_SIZE, y / CHUNK_SIZE, z / CHUNK_SIZE));
+   if (getWorldCube(x, y, z) == value)
+      return;
+   old = putWorldCube(x, y, z, value);
+   updateSolid(x, y, z, old, value);
+   if ((old == 0) != (value == 0))
+      updateColumn(x, y, z, value != 0);
+   addDirtyBox(x, y, z, x+1, y+1, z+1);
+   updateSurface(x, y, z, x+1, y+1, z+1);
+   if (value == 0)
+      releaseWorldChunks(x, y, z, x+1, y+1, z+1);
+}
+
+	/* set every cube from bx,by,bz up to but not including tx,ty,tz */
+	/* to value, the span is clipped to the size of the world, chunks */
+	/* which are empty are skipped when value is 0 and chunks which are */
+	/* completely covered are stored as a single colour */
+void fillWorldSpan(int bx, int by, int bz, int tx, int ty, int tz,
+   GLubyte value) {
+int x, y, z, cx, cy, cz, changed, whole, differ;
+WorldChunk *chunk;
+GLubyte old;
+
+   if (bx < 0) bx = 0;
+   if (by < 0) by = 0;
+   if (bz < 0) bz = 0;
+   if (tx > WORLDX) tx = WORLDX;
+   if (ty > WORLDY) ty = WORLDY;
+   if (tz > WORLDZ) tz = WORLDZ;
+
+   changed = 0;
+   for(cx=bx/CHUNK_SIZE; cx*CHUNK_SIZE<tx; cx++)
+      for(cy=by/CHUNK_SIZE; cy*CHUNK_SIZE<ty; cy++)
+         for(cz=bz/CHUNK_SIZE; cz*CHUNK_SIZE<tz; cz++) {
+            streamBeforeWrite(chunkIndex(cx, cy, cz));
+            chunk = worldChunkAt(chunkIndex(cx, cy, cz));
+            if ((value == 0) && (chunk == NULL))
+               continue;
+            whole = (bx <= cx*CHUNK_SIZE) && (tx >= (cx+1)*CHUNK_SIZE) &&
+                    (by <= cy*CHUNK_SIZE) && (ty >= (cy+1)*CHUNK_SIZE) &&
+                    (bz <= cz*CHUNK_SIZE) && (tz >= (cz+1)*CHUNK_SIZE);
+            differ = 0;
+            for(x=(bx > cx*CHUNK_SIZE) ? bx : cx*CHUNK_SIZE;
+                (x < tx) && (x < (cx+1)*CHUNK_SIZE); x++)
+               for(y=(by > cy*CHUNK_SIZE) ? by : cy*CHUNK_SIZE;
+                   (y < ty) && (y < (cy+1)*CHUNK_SIZE); y++)
+                  for(z=(bz > cz*CHUNK_SIZE) ? bz : cz*CHUNK_SIZE;
+                      (z < tz) && (z < (cz+1)*CHUNK_SIZE); z++) {
+			/* a whole chunk is replaced at once after the octree */
+			/* counts are updated */
+                     if (whole == 1)
+                        old = (chunk == NULL) ? 0 : chunkCube(chunk, cubeIndex(x, y, z));
+                     else
+                        old = putWorldCube(x, y, z, value);
+                     if (old != value) {
+                        updateSolid(x, y, z, old, value);
+                        differ = 1;
+                     }
+                  }
+            if ((whole == 1) && (differ == 1))
+               fillWorldChunk(cx * CHUNK_SIZE, cy * CHUNK_SIZE, cz * CHUNK_SIZE,
+                  value);
+            changed |= differ;
+         }
+   if (changed == 1) {
+      invalidateColumns(bx, bz, tx, tz);
+      addDirtyBox(bx, by, bz, tx, ty, tz);
+      updateSurface(bx, by, bz, tx, ty, tz);
+      if (value == 0)
+         releaseWorldChunks(bx, by, bz, tx, ty, tz);
+   }
+}
+
+	/* pass the boxes changed since the last call to the geometry cache */
+	/* a box is grown by one cube in each direction since changing a */
+	/* cube can hide or expose the faces of the cubes next to it */
+void flushWorldDirty() {
+int i, x, y, z;
+int bx, by, bz, tx, ty, tz;
+
+   dirtyChunkCount = 0;
+   for(i=0; i<dirtyCount; i++) {
+      bx = (dirtyBox[i].bx > 0) ? dirtyBox[i].bx - 1 : 0;
+      by = (dirtyBox[i].by > 0) ? dirtyBox[i].by - 1 : 0;
+      bz = (dirtyBox[i].bz > 0) ? dirtyBox[i].bz - 1 : 0;
+      tx = (dirtyBox[i].tx < WORLDX) ? dirtyBox[i].tx : WORLDX - 1;
+      ty = (dirtyBox[i].ty < WORLDY) ? dirtyBox[i].ty : WORLDY - 1;
+      tz = (dirtyBox[i].tz < WORLDZ) ? dirtyBox[i].tz : WORLDZ - 1;
+      dirtyOccluders(dirtyBox[i].bx, dirtyBox[i].bz, dirtyBox[i].tx,
+         dirtyBox[i].tz);
+      dirtyFlowField(dirtyBox[i].bx, dirtyBox[i].bz, dirtyBox[i].tx,
+         dirtyBox[i].tz);
+      for(x=bx/CHUNK_SIZE; x<=tx/CHUNK_SIZE; x++)
+         for(y=by/CHUNK_SIZE; y<=ty/CHUNK_SIZE; y++)
+            for(z=bz/CHUNK_SIZE; z<=tz/CHUNK_SIZE; z++) {
+               dirtyChunkMesh(x, y, z);
+               dirtyChunkCount++;
+            }
+   }
+   dirtyCount = 0;
+}